@@ -0,0 +1,501 @@
+// Benchmarks of the glyph rasterizer and stash, built with -DSCRIBER_BUILD_BENCH=ON.
+//
+//     bench [section] [font.ttf ...]
+//
+// Sections, all of them run if none is given:
+//     sdf      us per glyph of the SDF generators, for each SIMD level, and the error of EDT against the exact one.
+//              The cubic column rasterizes the glyphs raised to cubics, as CFF fonts have them. The exact generator
+//              is also timed without the skip of saturated blocks.
+//     packer   atlas occupancy of the shelf and skyline packers
+//     table    lookups in GlyphTable against the hash keyed std::map it replaced
+//     alloc    operator new calls and FreeType allocations per glyph cache miss
+//
+// The fonts default to those of the example. Timings are single threaded and vary by about 10% between runs on a
+// shared machine.
+
+#include "sdfRasterizer.h"
+#include "AtlasPacker.h"
+#include "GlyphTable.h"
+#include "GlyphBitmapStash.h"
+#include "FaceCollection.h"
+#include "IRenderAPI.h"
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace Scriber;
+
+static long g_allocations = 0;
+static long g_freetypeAllocations = 0;
+static bool g_countAllocations = false;
+
+void* operator new(size_t size)
+{
+	if (g_countAllocations)
+	{
+		++g_allocations;
+	}
+	void* p = malloc(size != 0 ? size : 1);
+	if (p == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// FreeType allocates through the FT_Memory of its library, not through operator new
+static void* FreeTypeAlloc(FT_Memory, long size)
+{
+	if (g_countAllocations)
+	{
+		++g_freetypeAllocations;
+	}
+	return malloc(size);
+}
+
+static void FreeTypeFree(FT_Memory, void* block)
+{
+	free(block);
+}
+
+static void* FreeTypeRealloc(FT_Memory, long, long size, void* block)
+{
+	if (g_countAllocations)
+	{
+		++g_freetypeAllocations;
+	}
+	return realloc(block, size);
+}
+
+// not in the header of the bundled FreeType, the library with a custom FT_Memory needs them
+extern "C" FT_Error FT_New_Library(FT_Memory memory, FT_Library* library);
+extern "C" FT_Error FT_Done_Library(FT_Library library);
+extern "C" void FT_Add_Default_Modules(FT_Library library);
+
+static double Now()
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char* GetName(const char* path)
+{
+	const char* slash = strrchr(path, '/');
+	return slash != nullptr ? slash + 1 : path;
+}
+
+// Copy of an outline with every conic raised to the cubic that traces the same curve, rounded to 26.6, as CFF fonts
+// have them
+struct CubicOutline
+{
+	std::vector<FT_Vector> points;
+	std::vector<char> tags;
+	std::vector<short> contours;
+	FT_Vector current;
+	FT_Outline outline;
+
+	static FT_Vector Point(FT_Pos x, FT_Pos y)
+	{
+		FT_Vector v;
+		v.x = x;
+		v.y = y;
+		return v;
+	}
+
+	static int MoveTo(const FT_Vector* to, void* user)
+	{
+		CubicOutline* o = static_cast<CubicOutline*>(user);
+		if (!o->points.empty())
+		{
+			o->contours.push_back((short)o->points.size() - 1);
+		}
+		return LineTo(to, user);
+	}
+
+	static int LineTo(const FT_Vector* to, void* user)
+	{
+		CubicOutline* o = static_cast<CubicOutline*>(user);
+		o->points.push_back(*to);
+		o->tags.push_back(FT_CURVE_TAG_ON);
+		o->current = *to;
+		return 0;
+	}
+
+	static int ConicTo(const FT_Vector* control, const FT_Vector* to, void* user)
+	{
+		CubicOutline* o = static_cast<CubicOutline*>(user);
+		FT_Vector a = o->current;
+		o->points.push_back(Point(a.x + (2 * (control->x - a.x) + 1) / 3, a.y + (2 * (control->y - a.y) + 1) / 3));
+		o->points.push_back(Point(to->x + (2 * (control->x - to->x) + 1) / 3, to->y + (2 * (control->y - to->y) + 1) / 3));
+		o->tags.push_back(FT_CURVE_TAG_CUBIC);
+		o->tags.push_back(FT_CURVE_TAG_CUBIC);
+		return LineTo(to, user);
+	}
+
+	static int CubicTo(const FT_Vector*, const FT_Vector*, const FT_Vector*, void*)
+	{
+		return 1;
+	}
+
+	explicit CubicOutline(const FT_Outline& source)
+	{
+		FT_Outline_Funcs funcs = {MoveTo, LineTo, ConicTo, CubicTo, 0, 0};
+		FT_Outline_Decompose(const_cast<FT_Outline*>(&source), &funcs, this);
+		if (!points.empty())
+		{
+			contours.push_back((short)points.size() - 1);
+		}
+		outline = source;
+		outline.points = points.data();
+		outline.tags = tags.data();
+		outline.contours = contours.data();
+		outline.n_points = (short)points.size();
+		outline.n_contours = (short)contours.size();
+	}
+};
+
+struct Face
+{
+	FT_Face face;
+	const char* path;
+	const char* name;
+};
+
+// Average time to rasterize one printable ASCII glyph, in us
+static double TimeGlyphs(const Face& face, int size, SDFGenerator::Enum generator, bool cubic = false)
+{
+	enum { k_rounds = 5 };
+	FT_Set_Char_Size(face.face, 0, size * 64, 72, 72);
+	std::vector<uint8_t> buffer;
+	FT_BitmapGlyphRec_ bitmap;
+	double time = 0.0;
+	int count = 0;
+	for (int c = 33; c < 127; ++c)
+	{
+		FT_UInt index = FT_Get_Char_Index(face.face, c);
+		if (index == 0 || FT_Load_Glyph(face.face, index, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING) != FT_Err_Ok)
+		{
+			continue;
+		}
+		FT_Outline& outline = face.face->glyph->outline;
+		CubicOutline cubicOutline(outline);
+		const FT_Outline& source = cubic ? cubicOutline.outline : outline;
+		for (int round = 0; round < k_rounds; ++round)
+		{
+			double start = Now();
+			RenderSDF(5, 0.5f, source, generator, buffer, bitmap);
+			time += Now() - start;
+		}
+		++count;
+	}
+	return count != 0 ? time / (k_rounds * count) : 0.0;
+}
+
+// Error of the EDT generator over printable ASCII, in pixels. Returns the number of pixels compared.
+static int CompareEDT(const Face& face, int size, double& mean, double& max)
+{
+	// the distance field drops by 32 per pixel, see RenderSDF
+	const double unitsPerPixel = 32.0;
+	FT_Set_Char_Size(face.face, 0, size * 64, 72, 72);
+	std::vector<uint8_t> exactBuffer;
+	std::vector<uint8_t> edtBuffer;
+	FT_BitmapGlyphRec_ exact;
+	FT_BitmapGlyphRec_ edt;
+	double sum = 0.0;
+	int count = 0;
+	max = 0.0;
+	for (int c = 33; c < 127; ++c)
+	{
+		FT_UInt index = FT_Get_Char_Index(face.face, c);
+		if (index == 0 || FT_Load_Glyph(face.face, index, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING) != FT_Err_Ok)
+		{
+			continue;
+		}
+		RenderSDF(5, 0.5f, face.face->glyph->outline, SDFGenerator::Exact, exactBuffer, exact);
+		RenderSDF(5, 0.5f, face.face->glyph->outline, SDFGenerator::EDT, edtBuffer, edt);
+		int pixelCount = exact.bitmap.width * exact.bitmap.rows;
+		for (int i = 0; i < pixelCount; ++i)
+		{
+			int value = exact.bitmap.buffer[i];
+			if (value == 0 || value == 255)
+			{
+				continue;
+			}
+			double error = std::abs(value - edt.bitmap.buffer[i]) / unitsPerPixel;
+			sum += error;
+			max = std::max(max, error);
+			++count;
+		}
+	}
+	mean = count != 0 ? sum / count : 0.0;
+	return count;
+}
+
+static void BenchSDF(const std::vector<Face>& faces)
+{
+	printf("SDF rasterization, us per glyph, printable ASCII\n");
+	const char* levels[] = {"", "baseline", "avx2", "avx512"};
+	for (const Face& face : faces)
+	{
+		for (int level = SIMDLevel::Baseline; level <= SIMDLevel::AVX512; ++level)
+		{
+			detail::SetSDFSIMDLevel(SIMDLevel::Enum(level));
+			if (detail::GetSDFSIMDLevel() != level)
+			{
+				continue;
+			}
+			for (int size : {16, 32, 64})
+			{
+				detail::SetSDFSkipSaturated(false);
+				double noSkip = TimeGlyphs(face, size, SDFGenerator::Exact);
+				detail::SetSDFSkipSaturated(true);
+				detail::ResetSDFStats();
+				double exact = TimeGlyphs(face, size, SDFGenerator::Exact);
+				detail::SDFStats stats = detail::GetSDFStats();
+				double cubic = TimeGlyphs(face, size, SDFGenerator::Exact, true);
+				double edt = TimeGlyphs(face, size, SDFGenerator::EDT);
+				double automatic = TimeGlyphs(face, size, SDFGenerator::Auto);
+				printf("  %-24s %-8s %2dpx  exact %7.1f (no skip %7.1f, %4.1f%% skipped)  cubic %7.1f  EDT %7.1f  auto %7.1f\n",
+						face.name, levels[level], size, exact, noSkip, 100.0 * stats.skippedPixels / std::max<uint64_t>(stats.pixels, 1),
+						cubic, edt, automatic);
+			}
+		}
+	}
+	detail::SetSDFSIMDLevel(SIMDLevel::Auto);
+
+	printf("EDT error against the exact generator, px, over the pixels the exact one does not saturate\n");
+	for (const Face& face : faces)
+	{
+		for (int size : {16, 32, 64})
+		{
+			double mean;
+			double max;
+			int pixels = CompareEDT(face, size, mean, max);
+			printf("  %-24s %2dpx  mean %.3f  max %.3f  (%d pixels)\n", face.name, size, mean, max, pixels);
+		}
+	}
+}
+
+static void BenchPacker(const std::vector<Face>& faces)
+{
+	printf("Atlas packers, random glyphs with SDF margins packed into 1024x1024 with spacing 3 until the first overflow\n");
+	const int ranges[][2] = {{12, 20}, {12, 48}, {16, 96}};
+	const Face& face = faces.front();
+	for (const auto& range : ranges)
+	{
+		std::mt19937 rng(1);
+		std::vector<ivec2> sizes;
+		for (int i = 0; i < 20000; ++i)
+		{
+			int size = range[0] + int(rng() % (range[1] - range[0] + 1));
+			FT_Set_Char_Size(face.face, 0, size * 64, 72, 72);
+			FT_Load_Glyph(face.face, FT_Get_Char_Index(face.face, 33 + rng() % 94), FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING);
+			FT_BBox box;
+			FT_Outline_Get_CBox(&face.face->glyph->outline, &box);
+			sizes.push_back(ivec2((box.xMax + 63) / 64 - box.xMin / 64 + 10, (box.yMax + 63) / 64 - box.yMin / 64 + 10));
+		}
+		for (int packer = AtlasPacker::Shelf; packer <= AtlasPacker::Skyline; ++packer)
+		{
+			IAtlasPackerPtr atlas = CreateAtlasPacker(AtlasPacker::Enum(packer), ivec2(1024 - 3));
+			long area = 0;
+			int count = 0;
+			double start = Now();
+			for (ivec2 size : sizes)
+			{
+				ivec2 position;
+				if (!atlas->Insert(size + ivec2(3), position))
+				{
+					break;
+				}
+				area += size.x * size.y;
+				++count;
+			}
+			double time = Now() - start;
+			printf("  %2d-%2dpx %-8s %5d glyphs, occupancy %.1f%%, %.2f us per insert\n", range[0], range[1],
+					packer == AtlasPacker::Shelf ? "shelf" : "skyline", count, 100.0 * area / (1024 * 1024), time / count);
+		}
+	}
+}
+
+static void BenchTable()
+{
+	printf("Glyph lookups, 4M random keys\n");
+	for (int n : {10000, 30000, 100000})
+	{
+		std::vector<GlyphKey> keys(n);
+		for (int i = 0; i < n; ++i)
+		{
+			GlyphKey& key = keys[i];
+			memset(&key, 0, sizeof(GlyphKey));
+			key.glyphIndex = GlyphID(i % 5000);
+			key.faceId = FaceID(1 + i / 5000 % 4);
+			key.height = uint16_t(12 + i / 20000);
+			key.dpi = u16vec2(72);
+		}
+
+		// the hash keyed map the table replaced
+		std::map<uint32_t, Glyph> map;
+		GlyphTable table;
+		Glyph glyph;
+		memset(&glyph, 0, sizeof(Glyph));
+		for (const GlyphKey& key : keys)
+		{
+			++glyph.m_code;
+			map.insert({XXH32(&key, sizeof(GlyphKey), 0), glyph});
+			table.Insert(key, glyph);
+		}
+
+		std::mt19937 rng(3);
+		std::vector<int> order(4000000);
+		for (int& i : order)
+		{
+			i = int(rng() % n);
+		}
+		uint64_t sum = 0;
+		double start = Now();
+		for (int i : order)
+		{
+			auto it = map.find(XXH32(&keys[i], sizeof(GlyphKey), 0));
+			sum += it != map.end() ? it->second.m_code : 0;
+		}
+		double mapTime = Now() - start;
+		start = Now();
+		for (int i : order)
+		{
+			sum += table.Find(keys[i])->m_code;
+		}
+		double tableTime = Now() - start;
+		printf("  %6d glyphs  std::map %6.1f ns  GlyphTable %6.1f ns  (%d)\n", n, mapTime * 1000.0 / order.size(),
+				tableTime * 1000.0 / order.size(), int(sum & 1));
+	}
+}
+
+class NullRenderAPI: public IRenderAPI
+{
+public:
+	void SaveTextureToFile() override {}
+	void UpdateTexture(uint16_t, Image, u16vec2) override {}
+	bool UpdateTextureRegions(const TextureRegion*, int) override { return true; }
+	void ClearTexture() override {}
+	void Render(uint16_t, Vertex*, uint16_t*, uint16_t, uint16_t) override {}
+};
+
+static void BenchAllocations(const char* path)
+{
+	printf("Allocations per glyph cache miss, printable ASCII at 32px, steady state\n");
+	FT_MemoryRec_ memory = {nullptr, FreeTypeAlloc, FreeTypeFree, FreeTypeRealloc};
+	FT_Library lib;
+	FT_New_Library(&memory, &lib);
+	FT_Add_Default_Modules(lib);
+	{
+		FaceCollection fc(lib);
+		TypefaceID tf = fc.NewTypeface("bench", 1);
+		fc.AndFontToTypeface(tf, path, FontStyle::Regular);
+		FaceID faceId = fc.GetFaceIDFromCode('a', tf, FontStyle::Regular);
+		FT_Face face = fc.GetFace(faceId);
+		const char* modes[] = {"SDF", "bitmap", "bitmap stroked"};
+		for (int mode = 0; mode < 3; ++mode)
+		{
+			GlyphBitmapStash stash(lib, &fc, std::make_shared<NullRenderAPI>());
+			stash.SetRasterMode(mode == 0 ? RasterMode::SDF : RasterMode::Bitmap);
+			Font font(tf, 32, FontStyle::Regular, 0xFFFFFFFF, mode == 2 ? 2 : 0);
+			long misses = 0;
+			g_allocations = 0;
+			g_freetypeAllocations = 0;
+			// the first rounds grow the buffers and tables
+			for (int round = 0; round < 6; ++round)
+			{
+				stash.Purge();
+				g_countAllocations = round >= 2;
+				for (int c = 33; c < 127; ++c)
+				{
+					stash.RetrieveGlyph(FT_Get_Char_Index(face, c), faceId, font, u16vec2(72));
+					misses += g_countAllocations ? 1 : 0;
+				}
+				g_countAllocations = false;
+				stash.FlushUploads();
+			}
+			printf("  %-15s %.2f operator new, %.2f FreeType allocations per miss\n", modes[mode], double(g_allocations) / misses,
+					double(g_freetypeAllocations) / misses);
+		}
+	}
+	FT_Done_Library(lib);
+}
+
+int main(int argc, char** argv)
+{
+	std::string section = argc > 1 ? argv[1] : "";
+	std::vector<const char*> paths;
+	for (int i = 2; i < argc; ++i)
+	{
+		paths.push_back(argv[i]);
+	}
+	if (paths.empty())
+	{
+		paths.push_back("../data/Roboto-Regular.ttf");
+		paths.push_back("../data/NotoSans-Bold.ttf");
+	}
+
+	FT_Library lib;
+	FT_Init_FreeType(&lib);
+	std::vector<Face> faces;
+	for (const char* path : paths)
+	{
+		FT_Face face;
+		if (FT_New_Face(lib, path, 0, &face) != FT_Err_Ok)
+		{
+			printf("Could not load %s\n", path);
+			continue;
+		}
+		faces.push_back({face, path, GetName(path)});
+	}
+	if (faces.empty())
+	{
+		return 1;
+	}
+
+	if (section.empty() || section == "sdf")
+	{
+		BenchSDF(faces);
+	}
+	if (section.empty() || section == "packer")
+	{
+		BenchPacker(faces);
+	}
+	if (section.empty() || section == "table")
+	{
+		BenchTable();
+	}
+	if (section.empty() || section == "alloc")
+	{
+		BenchAllocations(faces.front().path);
+	}
+
+	for (const Face& face : faces)
+	{
+		FT_Done_Face(face.face);
+	}
+	FT_Done_FreeType(lib);
+	return 0;
+}
@@ -35,6 +35,47 @@ namespace Scriber
 		};
 	};
 
+	struct RasterMode
+	{
+		enum Enum : uint8_t
+		{
+			Bitmap   = 0, // antialiased coverage, Font::stroke is rasterized into a second channel
+			SDF      = 1, // single channel signed distance field, outlines, glows and shadows are drawn from it
+			MSDF     = 2, // multi-channel signed distance field, keeps corners sharp at smaller sizes, needs an RGB8 atlas
+		};
+	};
+
+	struct SDFGenerator
+	{
+		enum Enum : uint8_t
+		{
+			Auto     = 0, // EDT for glyphs whose segments are dense for their pixel count, Exact otherwise
+			Exact    = 1, // distance to each outline segment, cost grows with the segment count
+			EDT      = 2, // distance transform of a supersampled coverage bitmap, cost only depends on the glyph size
+		};
+	};
+
+	struct SIMDLevel
+	{
+		enum Enum : uint8_t
+		{
+			Auto     = 0,
+
+			Baseline = 1, // SSE4 or NEON, 4 lanes
+			AVX2     = 2, // 8 lanes
+			AVX512   = 3, // 16 lanes
+		};
+	};
+
+	struct AtlasPacker
+	{
+		enum Enum : uint8_t
+		{
+			Shelf    = 0, // rows as tall as their tallest glyph
+			Skyline  = 1, // skyline bottom-left, fills the gaps above short glyphs
+		};
+	};
+
 	inline Align::Enum operator|(Align::Enum a, Align::Enum b)
 	{
 		return static_cast<Align::Enum>(static_cast<int>(a) | static_cast<int>(b));
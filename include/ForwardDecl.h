@@ -20,6 +20,7 @@ namespace Scriber
 	typedef std::function<size_t(void* ptr, size_t size, size_t count, UserFile* userfile)> freadfunc;
 	typedef std::function<int(UserFile* userfile, long int offset, int origin)> fseekfunc;
 	typedef std::function<long int(UserFile* userfile)> ftellfunc;
+	typedef std::function<size_t(const void* ptr, size_t size, size_t count, UserFile* userfile)> fwritefunc;
 
 	namespace detail
 	{
@@ -4,6 +4,7 @@
 #include "Image.h"
 
 #include <memory>
+#include <vector>
 
 namespace Scriber
 {
@@ -22,6 +23,43 @@ namespace Scriber
 			};
 			uint32_t color;
 		};
+
+		/// Color of the outline and glow of SDF and MSDF glyphs, 0 if there are none. Both are drawn from the distance
+		/// field, whose values are 0.5 at the edge of the glyph and drop by 32/255 per atlas texel away from it:
+		///     fill   = smoothstep(0.5 - aa, 0.5 + aa, d)
+		///     effect = smoothstep(effectEdge - effectSoftness - aa, effectEdge + aa, d)
+		///     result = mix(effectColor * effect, color, fill)
+		/// Drop shadows are quads of their own, drawn before the glyphs of all strings, with the shadow color in both.
+		uint32_t effectColor;
+
+		/// Distance field value, in 1/255, down to which the effect covers the glyph in full
+		uint8_t effectEdge;
+
+		/// Distance over which the effect fades out below effectEdge, in 1/255, 0 for an outline
+		uint8_t effectSoftness;
+
+		/// Atlas page the uv refers to, the same for all the vertices of one Render call
+		uint16_t page;
+	};
+
+	/// Part of an atlas page that changed since the previous upload
+	struct TextureRegion
+	{
+		uint16_t page;
+		u16vec2 pos;
+
+		/// View of the stash's copy of the page, its rows are GetRowSizeAligned() apart
+		Image image;
+	};
+
+	/// Moves a glyph within the atlas, from one page or position to another. Source and destination never overlap.
+	struct TextureCopy
+	{
+		uint16_t srcPage;
+		u16vec2 srcPos;
+		uint16_t dstPage;
+		u16vec2 dstPos;
+		u16vec2 size;
 	};
 
 	class IRenderAPI
@@ -31,11 +69,31 @@ namespace Scriber
 
 		virtual void SaveTextureToFile() = 0;
 
-		virtual void UpdateTexture(Image image, u16vec2 pos) = 0;
+		virtual void UpdateTexture(uint16_t page, Image image, u16vec2 pos) = 0;
+
+		/// Uploads the parts of the atlas that changed, once per frame before Render. Returning false, as the default does,
+		/// makes the stash call UpdateTexture for these regions and then for each glyph as it is stashed.
+		virtual bool UpdateTextureRegions(const TextureRegion* /*regions*/, int /*count*/) { return false; }
+
+		/// Copies parts of the atlas to other places in it, in order, after the Render calls of the frame. Returning false,
+		/// as the default does, makes the stash upload the moved glyphs from its copy of the atlas instead, or skip
+		/// compaction if it has none. Called with no copies to find out whether the backend copies.
+		virtual bool CopyTextureRegions(const TextureCopy* /*copies*/, int /*count*/) { return false; }
 
+		/// Clears all the pages
 		virtual void ClearTexture() = 0;
 
-		virtual void Render(Vertex* vertexBuffer, uint16_t* indexBuffer, uint16_t vertex_count, uint16_t primitiveCount) = 0;
+		/// Called before anything is stashed in the texture, and again when the format changes. R8 holds SDF glyphs and
+		/// plain fills, RG8 is only used once stroked glyphs are drawn and has their outline in the second channel, RGB8
+		/// holds MSDF glyphs. The texture is expected to be cleared.
+		virtual void SetTextureFormat(Image::DataType /*format*/) {}
+
+		/// Called when the stash needs more atlas pages, before anything is stashed in them. All pages have the size of
+		/// GetTextureSize() and the format of SetTextureFormat, new pages are expected to be cleared. The stash starts with one.
+		virtual void SetTexturePageCount(int /*count*/) {}
+
+		/// Called once per atlas page that has glyphs to draw in the frame
+		virtual void Render(uint16_t page, Vertex* vertexBuffer, uint16_t* indexBuffer, uint16_t vertex_count, uint16_t primitiveCount) = 0;
 
 		virtual int GetTextureSize() { return 1024; }
 
@@ -50,29 +108,75 @@ namespace Scriber
 	public:
 		SoftwareRenderAPI()
 		{
-			m_cacheTexture = Image::Empty(ivec2(1024), Image::RG8, 1);
-			m_screen = Image::Empty(ivec2(1024), Image::RG8, 1);
+			m_cacheTextures.push_back(Image::Empty(ivec2(1024), Image::R8, 1));
+			m_screen = Image::Empty(ivec2(1024), Image::R8, 1);
 		}
 
 		~SoftwareRenderAPI() =default;
 
 		void SaveTextureToFile() override
 		{
-			m_cacheTexture.SaveToTGA("TestCache.tga");
+			m_cacheTextures[0].SaveToTGA("TestCache.tga");
 		}
 
-		void UpdateTexture(Image image, u16vec2 pos) override
+		void UpdateTexture(uint16_t page, Image image, u16vec2 pos) override
 		{
-			m_cacheTexture.OpenView(ivec2(pos), image.GetSize()).Assign(image);
+			m_cacheTextures[page].OpenView(ivec2(pos), image.GetSize()).Assign(image);
+		}
+
+		bool UpdateTextureRegions(const TextureRegion* regions, int count) override
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				UpdateTexture(regions[i].page, regions[i].image, regions[i].pos);
+			}
+			return true;
+		}
+
+		bool CopyTextureRegions(const TextureCopy* copies, int count) override
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				const TextureCopy& copy = copies[i];
+				Image source = m_cacheTextures[copy.srcPage].OpenView(ivec2(copy.srcPos), ivec2(copy.size));
+				m_cacheTextures[copy.dstPage].OpenView(ivec2(copy.dstPos), ivec2(copy.size)).Assign(source);
+			}
+			return true;
 		}
 
 		void ClearTexture() override
 		{
-			m_cacheTexture.Clear();
+			for (Image& texture : m_cacheTextures)
+			{
+				texture.Clear();
+			}
+		}
+
+		void SetTextureFormat(Image::DataType format) override
+		{
+			if (m_cacheTextures[0].GetType() != format)
+			{
+				for (Image& texture : m_cacheTextures)
+				{
+					texture = Image::Empty(ivec2(1024), format, 1);
+				}
+				m_screen = Image::Empty(ivec2(1024), format, 1);
+			}
+		}
+
+		void SetTexturePageCount(int count) override
+		{
+			Image::DataType format = m_cacheTextures[0].GetType();
+			while ((int)m_cacheTextures.size() < count)
+			{
+				m_cacheTextures.push_back(Image::Empty(ivec2(1024), format, 1));
+			}
+			m_cacheTextures.resize(count);
 		}
 
-		void Render(Vertex* vertexBuffer, uint16_t* indexBuffer, uint16_t vertex_count, uint16_t primitiveCount) override
+		void Render(uint16_t page, Vertex* vertexBuffer, uint16_t* indexBuffer, uint16_t vertex_count, uint16_t primitiveCount) override
 		{
+			Image& cacheTexture = m_cacheTextures[page];
 			for (int i = 0; i < primitiveCount / 2; ++i)
 			{
 				i16vec2 pos = vertexBuffer[4 * i + 0].pos;
@@ -81,13 +185,13 @@ namespace Scriber
 				u16vec2 uv0 = vertexBuffer[4 * i + 0].uv;
 				u16vec2 uvSize = vertexBuffer[4 * i + 3].uv - uv0;
 
-				Image glyph = m_cacheTexture.OpenView(ivec2(uv0), ivec2(uvSize));
+				Image glyph = cacheTexture.OpenView(ivec2(uv0), ivec2(uvSize));
 				m_screen.OpenView(ivec2(pos), ivec2(size)).Assign(glyph);
 			}
 			m_screen.SaveToTGA("result.tga");
 		}
 	private:
-		Image m_cacheTexture;
+		std::vector<Image> m_cacheTextures;
 		Image m_screen;
 	};
 }
@@ -12,6 +12,11 @@ namespace Scriber
 			, style(style)
 			, color(color)
 			, stroke(stroke)
+			, glow(0)
+			, effectColor(0xFF000000)
+			, shadowColor(0)
+			, shadowX(0)
+			, shadowY(0)
 			, userdata(userdata) {};
 
 		Font(TypefaceID tf, uint16_t height, FontStyle::Enum style, uint32_t color, uint16_t stroke)
@@ -20,6 +25,11 @@ namespace Scriber
 			, style(style)
 			, color(color)
 			, stroke(stroke)
+			, glow(0)
+			, effectColor(0xFF000000)
+			, shadowColor(0)
+			, shadowX(0)
+			, shadowY(0)
 			, userdata(0) {};
 
 		Font(TypefaceID tf, uint16_t height, FontStyle::Enum style, uint32_t color)
@@ -28,6 +38,11 @@ namespace Scriber
 			, style(style)
 			, color(color)
 			, stroke(0)
+			, glow(0)
+			, effectColor(0xFF000000)
+			, shadowColor(0)
+			, shadowX(0)
+			, shadowY(0)
 			, userdata(0) {};
 
 		Font(TypefaceID tf, uint16_t height, FontStyle::Enum style)
@@ -36,6 +51,11 @@ namespace Scriber
 			, style(style)
 			, color(0xFFFFFFFF)
 			, stroke(0)
+			, glow(0)
+			, effectColor(0xFF000000)
+			, shadowColor(0)
+			, shadowX(0)
+			, shadowY(0)
 			, userdata(0) {};
 
 		Font(TypefaceID tf, uint16_t height)
@@ -44,16 +64,79 @@ namespace Scriber
 			, style(FontStyle::Regular)
 			, color(0xFFFFFFFF)
 			, stroke(0)
+			, glow(0)
+			, effectColor(0xFF000000)
+			, shadowColor(0)
+			, shadowX(0)
+			, shadowY(0)
 			, userdata(0) {};
 
 		TypefaceID preferred_tf;
 		uint16_t height;
 		FontStyle::Enum style;
 		uint32_t color;
+
+		/// Width of the outline in pixels. Bitmap glyphs are stroked into a second atlas channel, SDF and MSDF glyphs
+		/// draw it from their distance field, in effectColor, and share their bitmap with all the widths.
 		uint16_t stroke;
+
+		/// Width in pixels of a glow around SDF and MSDF glyphs, in effectColor, fading out past the outline
+		uint16_t glow;
+
+		/// Color of the outline and glow of SDF and MSDF glyphs
+		uint32_t effectColor;
+
+		/// Color of a drop shadow under SDF and MSDF glyphs, with their outline and glow, none if 0
+		uint32_t shadowColor;
+
+		/// Offset of the drop shadow, in the units of the label position, scaled with the font like the glyphs
+		int8_t shadowX;
+		int8_t shadowY;
+
 		UserData userdata;
 	};
 
+	struct AtlasStats
+	{
+		/// Fraction of the atlas area covered by glyph bitmaps
+		float occupancy;
+
+		/// Occupancy right before the last purge caused by a full atlas, 0 if there was none. Compares how well packers
+		/// fill the atlas.
+		float occupancyAtOverflow;
+
+		/// Number of times the glyphs drawn in one frame did not fit in the atlas, and a band already used in the frame
+		/// was evicted. Also counts the atlas being cleared in the middle of a frame for another format, when the first
+		/// stroked glyph of RasterMode::Bitmap is drawn. Strings drawn before may show wrong glyphs until the next frame.
+		uint32_t overflowCount;
+
+		/// Number of least recently used bands evicted to make room for new glyphs
+		uint32_t evictionCount;
+
+		/// Number of atlas pages in use, see Driver::SetAtlasPages
+		uint32_t pageCount;
+
+		/// Number of glyphs moved by atlas compaction, see Driver::CompactAtlas
+		uint32_t relocationCount;
+	};
+
+	struct PrewarmStats
+	{
+		/// Glyphs rasterized and placed in the atlas by the call, glyphs that were stashed already and those without a
+		/// bitmap are not counted
+		uint32_t glyphCount;
+
+		/// Atlas memory taken by the bitmaps of these glyphs
+		uint64_t atlasBytes;
+
+		/// The atlas ran out of room and the remaining characters were not stashed. Bands with glyphs of the current
+		/// frame, the prewarmed ones included, are not evicted for prewarming. See Driver::SetAtlasPages.
+		bool atlasFull;
+
+		/// Time the call took
+		float milliseconds;
+	};
+
 	class IRenderAPI;
 	typedef std::shared_ptr<IRenderAPI> IRenderAPIPtr;
 
@@ -62,7 +145,9 @@ namespace Scriber
 	public:
 		Driver();
 
-		static void SetCustomIOFunctions(fopenfunc open, fclosefunc close, freadfunc read, fseekfunc seek, ftellfunc tell);
+		/// Font files and atlas caches are opened, read and written with these functions. Without `write`
+		/// SaveAtlasCache fails.
+		static void SetCustomIOFunctions(fopenfunc open, fclosefunc close, freadfunc read, fseekfunc seek, ftellfunc tell, fwritefunc write = nullptr);
 
 		static void ResetIOFunctions();
 
@@ -78,12 +163,73 @@ namespace Scriber
 
 		void DrawLabel(const char* text, int position_x, int position_y, const Font& font, Align::Enum alignment = Align::Left, float true_hight= 0.f);
 
+		/// Extents of the label DrawLabel would draw, in the units of its position: the width of the widest line, the
+		/// ascent above the position and the descent below it, lines included. Only shapes the text and looks up glyph
+		/// metrics, nothing is rasterized or stashed. Any of the outputs may be nullptr.
+		void MeasureLabel(const char* text, const Font& font, float* width, float* ascent = nullptr, float* descent = nullptr);
+
 		void CleanStash();
 
+		/// Rasterizes and stashes the glyphs of the characters ahead of the frames that draw them, so that these frames
+		/// do not stall on rasterization. SDF and MSDF glyphs are rasterized concurrently. Uses the dpi of SetDPI, the
+		/// glyphs are uploaded with the next Render. Characters that no face has are skipped. Stops once the atlas is full,
+		/// see PrewarmStats::atlasFull.
+		PrewarmStats Prewarm(const char* utf8Chars, const Font& font);
+
+		/// Prewarms the characters from `first` to `last`, both included
+		PrewarmStats Prewarm(uint32_t first, uint32_t last, const Font& font);
+
+		/// Saves the stashed glyphs and the atlas to a file, so that later runs with the same fonts and settings load them
+		/// instead of rasterizing them again. Faces are recognized by the content of their font files. Returns false if
+		/// the file could not be written, and on backends whose UpdateTextureRegions returns false, as the pixels are
+		/// taken from the copy of the atlas that is only kept for such uploads.
+		bool SaveAtlasCache(const char* path);
+
+		/// Loads a file written by SaveAtlasCache, set the fonts, backend and raster settings up first. Files of other
+		/// versions, settings or atlas sizes, for fonts that are not loaded, and damaged ones are ignored, false is
+		/// returned and the stash is left as it is. The atlas is uploaded with the next Render, one region per page.
+		bool LoadAtlasCache(const char* path);
+
 		void Render();
 
 		void SetBackend(IRenderAPIPtr renderer);
 
+		/// Rasterizes every SDF glyph once, with an em of `size` pixels, and scales it to the size it is drawn at. Glyphs are
+		/// then shared between all font sizes and dpi settings. 0, the default, rasterizes them for each size. Cleans the stash.
+		void SetSDFReferenceSize(uint16_t size);
+
+		/// Selects how glyphs are rasterized into the atlas, RasterMode::SDF by default. Cleans the stash.
+		void SetRasterMode(RasterMode::Enum mode);
+
+		/// Selects the algorithm that generates single channel SDF glyphs, SDFGenerator::Auto by default. Only affects glyphs
+		/// rasterized after the call.
+		void SetSDFGenerator(SDFGenerator::Enum generator);
+
+		/// Forces the instruction set used by the SDF rasterizer, SIMDLevel::Auto picks the widest one supported by the CPU.
+		/// Levels that are not available fall back to the next narrower one. Returns the level actually in use.
+		static SIMDLevel::Enum SetSIMDLevel(SIMDLevel::Enum level);
+
+		static SIMDLevel::Enum GetSIMDLevel();
+
+		/// Selects how glyphs are placed in the atlas, AtlasPacker::Skyline by default. Cleans the stash.
+		void SetAtlasPacker(AtlasPacker::Enum packer);
+
+		/// Lets the glyphs spread over up to `maxPages` atlas textures, pages are added when the previous ones are full.
+		/// If `maxBytes` is not 0, the pages never take more memory than that, at least one page is always used. Eviction
+		/// only starts when the limit is reached. One page by default. Cleans the stash.
+		/// The atlas has at most 64 bands of about 128 pixel rows, as strings keep the bands they use in a 64 bit mask.
+		/// That caps the pages at 64 / (texture size / 128): 9 pages of 1024x1024, 4 of 2048x2048. Returns the number of
+		/// pages that can actually be used, with the byte limit applied to the current atlas format.
+		int SetAtlasPages(int maxPages, size_t maxBytes = 0);
+
+		/// Starts freeing the atlas bands that are mostly taken by glyphs that are no longer drawn, after a change of
+		/// language for instance. The glyphs drawn in the frame are moved into the room left in other bands, with texture
+		/// copies if the backend supports them, the others are dropped. One band per Render, until no band is worth it.
+		/// Strings using the moved glyphs are formatted again, their glyphs are not rasterized again.
+		void CompactAtlas();
+
+		AtlasStats GetAtlasStats() const;
+
 	private:
 		detail::DriverImplPtr m_impl;
 	};
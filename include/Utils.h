@@ -390,6 +390,12 @@ namespace Scriber
 	template<typename T>
 	inline vec2_t<T> clamp(const vec2_t<T>& v, T min, T max) { return vec2_t<T>(clamp(v.x, min, max), clamp(v.y, min, max)); }
 
+	template<typename T>
+	inline vec2_t<T> min(const vec2_t<T>& v1, const vec2_t<T>& v2) { return vec2_t<T>(min(v1.x, v2.x), min(v1.y, v2.y)); }
+
+	template<typename T>
+	inline vec2_t<T> max(const vec2_t<T>& v1, const vec2_t<T>& v2) { return vec2_t<T>(max(v1.x, v2.x), max(v1.y, v2.y)); }
+
 	template<typename T>
 	inline vec2_t<T> abs(const vec2_t<T>& v) { return vec2_t<T>(abs(v.x), abs(v.y)); }
 
@@ -399,6 +405,9 @@ namespace Scriber
 	template<typename T>
 	inline float length(const vec2_t<T>& v) { return sqrt(v.x * v.x + v.y * v.y); }
 
+	template<typename T>
+	inline vec2_t<T> normalize(const vec2_t<T>& v) { T l = length(v); return l > T(0) ? v / l : v; }
+
 	typedef vec2_t<int> ivec2;
 	typedef vec2_t<float> vec2;
 
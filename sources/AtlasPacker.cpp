@@ -0,0 +1,133 @@
+#include "AtlasPacker.h"
+
+#include <algorithm>
+
+using namespace Scriber;
+
+
+ShelfPacker::ShelfPacker(ivec2 size): m_size(size)
+{
+	Clear();
+}
+
+bool ShelfPacker::Insert(ivec2 size, ivec2& position)
+{
+	if (m_cursor.x + size.x > m_size.x)
+	{
+		m_cursor = ivec2(0, m_rowBottom);
+	}
+	if (m_cursor.x + size.x > m_size.x || m_cursor.y + size.y > m_size.y)
+	{
+		return false;
+	}
+	position = m_cursor;
+	m_cursor.x += size.x;
+	m_rowBottom = std::max(m_rowBottom, m_cursor.y + size.y);
+	return true;
+}
+
+void ShelfPacker::Clear()
+{
+	m_cursor = ivec2(0);
+	m_rowBottom = 0;
+}
+
+
+SkylinePacker::SkylinePacker(ivec2 size): m_size(size)
+{
+	Clear();
+}
+
+int SkylinePacker::Fit(size_t segment, ivec2 size) const
+{
+	if (m_skyline[segment].x + size.x > m_size.x)
+	{
+		return -1;
+	}
+	int y = 0;
+	for (int widthLeft = size.x; widthLeft > 0; widthLeft -= m_skyline[segment++].width)
+	{
+		y = std::max(y, m_skyline[segment].y);
+		if (y + size.y > m_size.y)
+		{
+			return -1;
+		}
+	}
+	return y;
+}
+
+bool SkylinePacker::Insert(ivec2 size, ivec2& position)
+{
+	int bestBottom = m_size.y + 1;
+	int bestWidth = 0;
+	size_t best = m_skyline.size();
+	for (size_t i = 0; i < m_skyline.size(); ++i)
+	{
+		int y = Fit(i, size);
+		if (y < 0)
+		{
+			continue;
+		}
+		if (y + size.y < bestBottom || (y + size.y == bestBottom && m_skyline[i].width < bestWidth))
+		{
+			bestBottom = y + size.y;
+			bestWidth = m_skyline[i].width;
+			best = i;
+			position = ivec2(m_skyline[i].x, y);
+		}
+	}
+	if (best == m_skyline.size())
+	{
+		return false;
+	}
+
+	m_skyline.insert(m_skyline.begin() + best, Segment{position.x, position.y + size.y, size.x});
+
+	// cut the segments that are now under the rectangle
+	int right = position.x + size.x;
+	for (size_t i = best + 1; i < m_skyline.size();)
+	{
+		Segment& segment = m_skyline[i];
+		if (segment.x >= right)
+		{
+			break;
+		}
+		int cut = right - segment.x;
+		if (cut >= segment.width)
+		{
+			m_skyline.erase(m_skyline.begin() + i);
+			continue;
+		}
+		segment.x += cut;
+		segment.width -= cut;
+		break;
+	}
+
+	// merge neighbours of the same height
+	for (size_t i = 0; i + 1 < m_skyline.size();)
+	{
+		if (m_skyline[i].y == m_skyline[i + 1].y)
+		{
+			m_skyline[i].width += m_skyline[i + 1].width;
+			m_skyline.erase(m_skyline.begin() + i + 1);
+			continue;
+		}
+		++i;
+	}
+	return true;
+}
+
+void SkylinePacker::Clear()
+{
+	m_skyline.assign(1, Segment{0, 0, m_size.x});
+}
+
+
+IAtlasPackerPtr Scriber::CreateAtlasPacker(AtlasPacker::Enum packer, ivec2 size)
+{
+	switch (packer)
+	{
+		case AtlasPacker::Shelf: return IAtlasPackerPtr(new ShelfPacker(size));
+		default: return IAtlasPackerPtr(new SkylinePacker(size));
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "Attributes.h"
+#include "Utils.h"
+
+#include <memory>
+#include <vector>
+
+namespace Scriber
+{
+	// Allocates rectangles of the glyph atlas. They are not freed one by one, only all at once with Clear.
+	class IAtlasPacker
+	{
+	public:
+		virtual ~IAtlasPacker() {}
+
+		// Returns false if there is no room left for the rectangle
+		virtual bool Insert(ivec2 size, ivec2& position) = 0;
+
+		virtual void Clear() = 0;
+	};
+
+	typedef std::unique_ptr<IAtlasPacker> IAtlasPackerPtr;
+
+	// Rows as tall as their tallest rectangle, filled from left to right
+	class ShelfPacker: public IAtlasPacker
+	{
+	public:
+		explicit ShelfPacker(ivec2 size);
+
+		bool Insert(ivec2 size, ivec2& position) override;
+
+		void Clear() override;
+
+	private:
+		ivec2 m_size;
+		ivec2 m_cursor;
+		int m_rowBottom;
+	};
+
+	// Skyline bottom-left. The lower edge of the packed area is a list of horizontal segments, a rectangle goes where its
+	// bottom ends up highest in the atlas, the narrowest segment first.
+	class SkylinePacker: public IAtlasPacker
+	{
+	public:
+		explicit SkylinePacker(ivec2 size);
+
+		bool Insert(ivec2 size, ivec2& position) override;
+
+		void Clear() override;
+
+	private:
+		struct Segment
+		{
+			int x;
+			int y;
+			int width;
+		};
+
+		// Lowest y at which a rectangle that starts at the segment fits, -1 if it does not
+		int Fit(size_t segment, ivec2 size) const;
+
+		ivec2 m_size;
+		std::vector<Segment> m_skyline;
+	};
+
+	IAtlasPackerPtr CreateAtlasPacker(AtlasPacker::Enum packer, ivec2 size);
+}
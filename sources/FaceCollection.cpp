@@ -14,6 +14,9 @@
 #include <freetype.h>
 #include <algorithm>
 
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
 using namespace Scriber;
 
 FaceCollection::FaceCollection(FT_Library lib): m_lib(lib)
@@ -108,6 +111,7 @@ void FaceCollection::AndFontToTypeface(TypefaceID tf, const char* filename, Font
 FaceCollection::Typeface::Typeface()
 {
 	InitArray(m_faces, FT_Face(nullptr));
+	InitArray(m_contentHashes, uint64_t(0));
 }
 
 bool FaceCollection::HasFaceIDCode(uint32_t code, FaceID faceID) const
@@ -221,3 +225,37 @@ hb_font_t* FaceCollection::GetHBFontByFaceId(FaceID id)
 	}
 	return m_typefaces[GetTypefaceID(id)].m_HBfonts[GetFontStyle(id)];
 }
+
+uint64_t FaceCollection::GetContentHash(FaceID id) const
+{
+	const Typeface& typeface = m_typefaces[GetTypefaceID(id)];
+	uint64_t& hash = typeface.m_contentHashes[GetFontStyle(id)];
+	FT_Face face = typeface.m_faces[GetFontStyle(id)];
+	FT_ULong length = 0;
+	if (hash == 0 && face != nullptr && FT_Load_Sfnt_Table(face, 0, 0, nullptr, &length) == FT_Err_Ok)
+	{
+		// tag 0 loads the whole file
+		std::vector<FT_Byte> data(length);
+		if (FT_Load_Sfnt_Table(face, 0, 0, data.data(), &length) == FT_Err_Ok)
+		{
+			hash = XXH64(data.data(), length, (unsigned long long)face->face_index);
+			hash = hash != 0 ? hash : 1;
+		}
+	}
+	return hash;
+}
+
+void FaceCollection::GetFaceIDs(std::vector<FaceID>& faces) const
+{
+	faces.clear();
+	for (int tf = 0; tf < (int)m_typefaces.size(); ++tf)
+	{
+		for (int style = 0; style < FontStyle::BitFieldSize; ++style)
+		{
+			if (m_typefaces[tf].m_faces[style] != nullptr)
+			{
+				faces.push_back(GetFaceID(TypefaceID(tf), FontStyle::Enum(style)));
+			}
+		}
+	}
+}
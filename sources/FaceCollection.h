@@ -24,6 +24,13 @@ namespace Scriber
 		FT_Face GetFace(FaceID id) const;
 
 		hb_font_t* GetHBFontByFaceId(FaceID id);
+
+		// Hash of the content of the font file and of the index of the face in it, computed on first use. 0 if the face
+		// is not in an SFNT font, as only these can be read back whole.
+		uint64_t GetContentHash(FaceID id) const;
+
+		// The faces of all typefaces
+		void GetFaceIDs(std::vector<FaceID>& faces) const;
 	private:
 		struct Typeface
 		{
@@ -31,6 +38,7 @@ namespace Scriber
 
 			FT_Face m_faces[FontStyle::BitFieldSize];
 			hb_font_t* m_HBfonts[FontStyle::BitFieldSize];
+			mutable uint64_t m_contentHashes[FontStyle::BitFieldSize];
 			Script  m_script;
 			int priority;
 		};
@@ -0,0 +1,63 @@
+#include "FileIO.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace Scriber;
+using namespace Scriber::detail;
+
+static fopenfunc s_open;
+static fclosefunc s_close;
+static freadfunc s_read;
+static fseekfunc s_seek;
+static ftellfunc s_tell;
+static fwritefunc s_write;
+
+void io::SetFunctions(fopenfunc open, fclosefunc close, freadfunc read, fseekfunc seek, ftellfunc tell, fwritefunc write)
+{
+	s_open = open;
+	s_close = close;
+	s_read = read;
+	s_seek = seek;
+	s_tell = tell;
+	s_write = write;
+}
+
+UserFile* io::Open(const char* filename, const char* mode)
+{
+	if (s_open && !s_write && strpbrk(mode, "wa+") != nullptr)
+	{
+		// the file could not be written
+		return nullptr;
+	}
+	return s_open ? s_open(filename, mode) : (UserFile*)fopen(filename, mode);
+}
+
+int io::Close(UserFile* file)
+{
+	return s_open ? s_close(file) : fclose((FILE*)file);
+}
+
+size_t io::Read(void* ptr, size_t size, size_t count, UserFile* file)
+{
+	return s_open ? s_read(ptr, size, count, file) : fread(ptr, size, count, (FILE*)file);
+}
+
+size_t io::Write(const void* ptr, size_t size, size_t count, UserFile* file)
+{
+	if (s_open)
+	{
+		return s_write ? s_write(ptr, size, count, file) : 0;
+	}
+	return fwrite(ptr, size, count, (FILE*)file);
+}
+
+int io::Seek(UserFile* file, long int offset, int origin)
+{
+	return s_open ? s_seek(file, offset, origin) : fseek((FILE*)file, offset, origin);
+}
+
+long int io::Tell(UserFile* file)
+{
+	return s_open ? s_tell(file) : ftell((FILE*)file);
+}
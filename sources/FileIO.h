@@ -0,0 +1,29 @@
+#pragma once
+#include "ForwardDecl.h"
+
+namespace Scriber
+{
+	namespace detail
+	{
+		// Files of the library go through the functions of Driver::SetCustomIOFunctions once they are set, through stdio
+		// otherwise
+		namespace io
+		{
+			void SetFunctions(fopenfunc open, fclosefunc close, freadfunc read, fseekfunc seek, ftellfunc tell, fwritefunc write);
+
+			// nullptr for modes that write if the custom functions have no write function
+			UserFile* Open(const char* filename, const char* mode);
+
+			int Close(UserFile* file);
+
+			size_t Read(void* ptr, size_t size, size_t count, UserFile* file);
+
+			// 0 if the custom functions have no write function
+			size_t Write(const void* ptr, size_t size, size_t count, UserFile* file);
+
+			int Seek(UserFile* file, long int offset, int origin);
+
+			long int Tell(UserFile* file);
+		}
+	}
+}
@@ -37,6 +37,11 @@ namespace Scriber
 
 		uint32_t m_code; // ?
 		u16vec2  m_cacheUV;
+		uint16_t m_cachePage;
+
+		/// Size at which the bitmap is drawn relative to the size it was rasterized at, 8.8 fixed point. It is not 256 only
+		/// for SDF glyphs shared between font sizes, see Driver::SetSDFReferenceSize.
+		uint16_t m_bitmapScale;
 		uint32_t m_color;
 	};
 
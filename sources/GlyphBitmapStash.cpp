@@ -1,50 +1,94 @@
 #include "GlyphBitmapStash.h"
 #include "FaceCollection.h"
+#include "FileIO.h"
 #include "Image.h"
 
 #include <freetype.h>
 
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
 #ifdef FONT_SDF
 #include "sdfRasterizer.h"
+#include "msdfRasterizer.h"
 #endif
 
-#define XXH_INLINE_ALL
-#include <xxhash.h>
-
 #include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+
+#if !defined(SCRIBER_SDF_USE_OMP)
+#if defined(_OPENMP)
+#define SCRIBER_SDF_USE_OMP 1
+#else
+#define SCRIBER_SDF_USE_OMP 0
+#endif
+#endif
 
 using namespace Scriber;
 
+struct GlyphBitmapStash::RasterTask
+{
+	GlyphKey key;
+	Glyph glyph;
+	bool hasOutline;
+	FT_Outline outline;
+	std::vector<FT_Vector> points;
+	std::vector<uint8_t> buffer;
+	FT_BitmapGlyphRec_ bitmap;
+};
 
 GlyphBitmapStash::GlyphBitmapStash(FT_Library lib, FaceCollection* fc, IRenderAPIPtr renderAPI)
 
 	: m_bitmap(nullptr)
 	, m_bitmapSize(0)
 	, m_fc(fc)
+	, m_outlineCache(fc)
+	, m_kerning(fc)
+	, m_metrics(fc, &m_outlineCache)
 	, m_stashTextureSize(renderAPI->GetTextureSize())
-	, m_maxHeight(0)
+	, m_sdfReferenceSize(0)
+	, m_rasterMode(RasterMode::SDF)
+	, m_sdfGenerator(SDFGenerator::Auto)
 	, m_spacing(renderAPI->GetSpacing())
-	, m_currentPos(m_spacing)
+	, m_packerType(AtlasPacker::Skyline)
+	, m_bandsPerPage(0)
+	, m_bandHeight(0)
+	, m_maxPages(1)
+	, m_maxPageBytes(0)
+	, m_frame(1)
+	, m_evictions(0)
+	, m_atlasFormat(Image::R8)
+	, m_uploadPerGlyph(false)
+	, m_compacting(false)
+	, m_prewarming(false)
+	, m_compactDone(0)
 	, m_renderAPI(std::move(renderAPI))
 	, m_stroker(nullptr)
 	, m_lib(lib)
-	, m_glyph({{F26p6(0), F26p6(0), F26p6(0), i16vec2(0), u16vec2(0)} ,0, u16vec2(0), 0})
-	, m_was_overflowed(false)
+	, m_glyph({{F26p6(0), F26p6(0), F26p6(0), i16vec2(0), u16vec2(0)} ,0, u16vec2(0), 0, 256, 0})
 {
+	memset(&m_stats, 0, sizeof(AtlasStats));
+	CreateBands(AtlasPacker::Skyline);
+	m_renderAPI->SetTextureFormat(m_atlasFormat);
 	FT_Stroker_New(lib, &m_stroker);
 }
 
-void GlyphBitmapStash::ResizeBitmap(uint16_t newSize)
+Image GlyphBitmapStash::GetStagingImage(ivec2 size, bool clear)
 {
-	if (m_bitmapSize < newSize)
+	size_t bytes = size_t(size.x) * size.y * 2;
+	if (m_bitmapSize < bytes)
 	{
-		m_bitmapSize = NextPowerOf2(newSize);
+		m_bitmapSize = NextPowerOf2(uint32_t(bytes));
+		delete[] m_bitmap;
+		m_bitmap = new uint8_t[m_bitmapSize];
 	}
-	m_bitmapSize = newSize;
-	int size = m_bitmapSize * m_bitmapSize * 2;
-	delete[] m_bitmap;
-	m_bitmap = new uint8_t[size];
-	memset(m_bitmap, 0, size);
+	if (clear)
+	{
+		memset(m_bitmap, 0, bytes);
+	}
+	return Image::FromMemory(m_bitmap, Image::RG8, size, 1);
 }
 
 GlyphBitmapStash::~GlyphBitmapStash()
@@ -64,120 +108,451 @@ inline FT_BitmapGlyph ConvertToStrokedBitmapGlyph(FT_Glyph glyph, FT_Stroker str
 	return bitmapGlyph;
 }
 
-inline FT_BitmapGlyph ConvertToBitmapGlyph(FT_Glyph glyph, FT_Face face, bool sdf)
+inline FT_BitmapGlyph ConvertToBitmapGlyph(FT_Glyph glyph)
+{
+	FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_NORMAL, 0, 0);
+	FT_BitmapGlyph bitmapGlyph = (FT_BitmapGlyph) glyph;
+	return bitmapGlyph;
+}
+
+GlyphKey GlyphBitmapStash::GetGlyphKey(GlyphID glyphIndex, FaceID faceId, const Font& font, u16vec2 dpi) const
+{
+	GlyphKey data;
+	memset(&data, 0, sizeof(GlyphKey));
+
+	// SDF glyphs at the reference size are shared by all font sizes, zero dpi keeps them apart from the regular ones
+	bool reference = m_rasterMode != RasterMode::Bitmap && m_sdfReferenceSize != 0;
+
+	data.glyphIndex = glyphIndex;
+	data.faceId = faceId;
+	data.height = reference ? m_sdfReferenceSize : font.height;
+	data.style = font.style;
+	// distance field glyphs draw their outline from the field, one bitmap serves every stroke width
+	data.stroke = m_rasterMode == RasterMode::Bitmap ? font.stroke : 0;
+	data.dpi = reference ? u16vec2(0) : dpi;
+	return data;
+}
+
+FT_Face GlyphBitmapStash::LoadGlyph(GlyphID glyphIndex, FaceID faceId, const Font& font, u16vec2 dpi, Glyph& glyph)
+{
+	FT_Face face = m_fc->GetFace(faceId);
+	FT_Set_Char_Size(face, 0, F26p6(font.height).v, dpi.x, dpi.y);
+
+	if (FT_Load_Glyph(face, glyphIndex, FT_LOAD_NO_BITMAP) != FT_Err_Ok)
+	{
+		return nullptr;
+	}
+
+	glyph.m_metrics.horiAdvance.v = face->glyph->metrics.horiAdvance;
+	//glyph.m_metrics.vertAdvance.v = face->glyph->metrics.vertAdvance;
+	glyph.m_metrics.ascender.v = face->size->metrics.ascender;
+	glyph.m_metrics.descender.v = face->size->metrics.descender;
+	return face;
+}
+
+FT_Face GlyphBitmapStash::SetOutlineMetrics(const GlyphOutline& outline, FaceID faceId, const Font& font, u16vec2 dpi, Glyph& glyph)
 {
-	if (sdf)
+	FT_Face face = m_fc->GetFace(faceId);
+	bool reference = m_sdfReferenceSize != 0;
+	if (reference)
 	{
-		return RenderSDF(5, 0.5, face);
+		FT_Set_Char_Size(face, 0, F26p6(m_sdfReferenceSize).v, 72, 72);
 	}
 	else
 	{
-		FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_NORMAL, 0, 0);
-		FT_BitmapGlyph bitmapGlyph = (FT_BitmapGlyph) glyph;
-		return bitmapGlyph;
+		FT_Set_Char_Size(face, 0, F26p6(font.height).v, dpi.x, dpi.y);
 	}
+
+	// Outlines are unhinted, so that the reference size scales linearly to the other sizes. At the font's own size
+	// the advance is rounded to whole pixels, as hinting does.
+	FT_Pos advance = FT_MulFix(outline.advance, face->size->metrics.x_scale);
+	glyph.m_metrics.horiAdvance.v = reference ? advance : (advance + 32) & -64;
+	glyph.m_metrics.ascender.v = face->size->metrics.ascender;
+	glyph.m_metrics.descender.v = face->size->metrics.descender;
+	return face;
 }
 
-Glyph& GlyphBitmapStash::RetrieveGlyph(GlyphID glyphIndex, GlyphID previousGlyphIndex, FaceID faceId, const Font& font, u16vec2 dpi, bool sdf)
+// Scales the cached outline to the size set on the face, the way FreeType scales unhinted glyphs. The scaled outline
+// shares the tags and contours of the cached one.
+static void ScaleOutline(const GlyphOutline& source, FT_Face face, std::vector<FT_Vector>& points, FT_Outline& outline)
 {
-	struct Data
-	{
-		GlyphID glyphIndex;
-		FaceID faceId;
-		uint16_t height;
-		FontStyle::Enum style;
-		uint16_t stroke;
-		u16vec2 dpi;
-	} data;
-	memset(&data, 0, sizeof(Data));
-	
-	data.glyphIndex = glyphIndex;
-	data.faceId = faceId;
-	data.height = font.height;
-	data.style = font.style;
-	data.stroke = font.stroke;
-	data.dpi = dpi;
+	FT_Fixed x_scale = face->size->metrics.x_scale;
+	FT_Fixed y_scale = face->size->metrics.y_scale;
 
-	GlyphHash hash = XXH32(&data, sizeof(Data), 0);
+	points.resize(source.points.size());
+	for (size_t i = 0; i < points.size(); ++i)
+	{
+		points[i].x = FT_MulFix(source.points[i].x, x_scale);
+		points[i].y = FT_MulFix(source.points[i].y, y_scale);
+	}
 
-	auto lb = m_glyphs.lower_bound(hash);
+	memset(&outline, 0, sizeof(FT_Outline));
+	outline.n_points = (short)source.points.size();
+	outline.n_contours = (short)source.contours.size();
+	outline.points = points.data();
+	outline.tags = const_cast<char*>(source.tags.data());
+	outline.contours = const_cast<short*>(source.contours.data());
+	outline.flags = source.flags;
+}
 
-	if (lb != m_glyphs.end() && (hash == lb->first))
+// Distance field of the outline in the given mode, an empty bitmap for glyphs that have no outline
+static FT_BitmapGlyph RenderDistanceField(RasterMode::Enum mode, SDFGenerator::Enum generator, const FT_Outline* outline, std::vector<uint8_t>& buffer, FT_BitmapGlyphRec_& bitmap)
+{
+	if (outline == nullptr)
 	{
-		return lb->second;
+		memset(&bitmap, 0, sizeof(FT_BitmapGlyphRec_));
+		bitmap.root.format = FT_GLYPH_FORMAT_BITMAP;
+		return &bitmap;
 	}
-	else
+	return mode == RasterMode::MSDF
+			? RenderMSDF(5, 0.5, *outline, buffer, bitmap)
+			: RenderSDF(5, 0.5, *outline, generator, buffer, bitmap);
+}
+
+Glyph& GlyphBitmapStash::RetrieveGlyph(GlyphID glyphIndex, FaceID faceId, const Font& font, u16vec2 dpi)
+{
+	GlyphKey key = GetGlyphKey(glyphIndex, faceId, font, dpi);
+
+	Glyph* cached = m_glyphs.Find(key);
+	if (cached != nullptr)
 	{
-        FT_Face face = m_fc->GetFace(faceId);
+		TouchGlyph(*cached);
+		return *cached;
+	}
 
-		FT_Set_Char_Size(face, 0, F26p6(font.height).v, dpi.x, dpi.y);
+	if (m_rasterMode != RasterMode::Bitmap)
+	{
+		// a batch of one, it is only missing afterwards if the glyph could not be loaded
+		GlyphRequest request = {glyphIndex, faceId};
+		PrefetchGlyphs(&request, 1, font, dpi);
 
-		FT_Error error = FT_Load_Glyph(face, glyphIndex, FT_LOAD_NO_BITMAP);
+		cached = m_glyphs.Find(key);
+		if (cached != nullptr)
+		{
+			return *cached;
+		}
+	}
+	else if (StashBitmapGlyph(glyphIndex, faceId, font, dpi) == StashResult::Stashed)
+	{
+		return m_glyphs.Insert(key, m_glyph);
+	}
 
-        if (error == FT_Err_Ok)
-        {
-			FT_Glyph ftglyph = nullptr;
+	FaceID result = m_fc->GetFaceIDFromCode(0x25A1, font.preferred_tf, font.style);
+	FT_UInt replacementIndex = FT_Get_Char_Index(m_fc->GetFace(result), 0x25A1);
+	m_glyph = RetrieveGlyph(replacementIndex, result, font, dpi);
+	m_glyph.m_code = 0;
+	return m_glyph;
+}
 
-			FT_Error error = FT_Get_Glyph(face->glyph, &ftglyph);
+GlyphBitmapStash::StashResult::Enum GlyphBitmapStash::StashBitmapGlyph(GlyphID glyphIndex, FaceID faceId, const Font& font, u16vec2 dpi)
+{
+	if (font.stroke > 0)
+	{
+		// the outline goes to a second channel, the atlas only has it once stroked glyphs are used
+		SetAtlasFormat(Image::RG8);
+	}
 
-			if (error == FT_Err_Ok)
-			{
-				m_glyph.m_metrics.horiAdvance.v = face->glyph->metrics.horiAdvance;
-				//glyph.m_metrics.vertAdvance.v = face->glyph->metrics.vertAdvance;
-				m_glyph.m_metrics.ascender.v = face->size->metrics.ascender;
-				m_glyph.m_metrics.descender.v = face->size->metrics.descender;
+	FT_Face face = LoadGlyph(glyphIndex, faceId, font, dpi, m_glyph);
+	if (face == nullptr)
+	{
+		return StashResult::Failed;
+	}
 
-				bool use_kerning = FT_HAS_KERNING( face );
-				if (use_kerning && previousGlyphIndex != 0 && glyphIndex != 0)
-				{
-					FT_Vector  delta;
-					FT_Get_Kerning(face, previousGlyphIndex, glyphIndex, FT_KERNING_DEFAULT, &delta);
-					m_glyph.m_metrics.horiAdvance.v += delta.x;
-				}
+	bool stashed = true;
+	FT_Glyph ftglyph = nullptr;
 
-				FT_BitmapGlyph ftbitmapGlyph = ConvertToBitmapGlyph(ftglyph, face, sdf);
+	FT_Error error = FT_Get_Glyph(face->glyph, &ftglyph);
 
-				if(font.stroke > 0 && !sdf)
-				{
-					FT_BitmapGlyph ftoutlinebitmapGlyph = ConvertToStrokedBitmapGlyph(ftglyph, m_stroker, font.stroke, face);
+	if (error == FT_Err_Ok)
+	{
+		FT_BitmapGlyph ftbitmapGlyph = ConvertToBitmapGlyph(ftglyph);
 
-					Stash(m_glyph, ftbitmapGlyph, ftoutlinebitmapGlyph, font.userdata);
+		if(font.stroke > 0)
+		{
+			FT_BitmapGlyph ftoutlinebitmapGlyph = ConvertToStrokedBitmapGlyph(ftglyph, m_stroker, font.stroke, face);
 
-					FT_Done_Glyph((FT_Glyph)ftoutlinebitmapGlyph);
-					FT_Done_Glyph((FT_Glyph)ftbitmapGlyph);
-					FT_Done_Glyph((FT_Glyph)ftglyph);
-				}
-				else
-				{
-					Stash(m_glyph, ftbitmapGlyph, nullptr, font.userdata);
+			stashed = Stash(m_glyph, ftbitmapGlyph, ftoutlinebitmapGlyph, font.userdata);
 
-					FT_Done_Glyph((FT_Glyph)ftbitmapGlyph);
-					FT_Done_Glyph((FT_Glyph)ftglyph);
-				}
-			}
-        }
+			FT_Done_Glyph((FT_Glyph)ftoutlinebitmapGlyph);
+			FT_Done_Glyph((FT_Glyph)ftbitmapGlyph);
+			FT_Done_Glyph((FT_Glyph)ftglyph);
+		}
 		else
 		{
-			FaceID result = m_fc->GetFaceIDFromCode(0x25A1, font.preferred_tf, font.style);
-			FT_UInt glyphIndex = FT_Get_Char_Index(m_fc->GetFace(result), 0x25A1);
-			m_glyph = RetrieveGlyph(glyphIndex, 0, result, font, dpi, sdf);
-			m_glyph.m_code = 0;
-			return m_glyph;
+			stashed = Stash(m_glyph, ftbitmapGlyph, nullptr, font.userdata);
+
+			FT_Done_Glyph((FT_Glyph)ftbitmapGlyph);
+			FT_Done_Glyph((FT_Glyph)ftglyph);
+		}
+	}
+
+	return stashed ? StashResult::Stashed : StashResult::AtlasFull;
+}
+
+bool GlyphBitmapStash::PrefetchGlyphs(const GlyphRequest* requests, int count, const Font& font, u16vec2 dpi, PrewarmStats* stats)
+{
+	if (m_rasterMode == RasterMode::Bitmap)
+	{
+		return true;
+	}
+
+	// FreeType faces are not thread safe, so the outlines are fetched and scaled here. They come from the outline
+	// cache, only glyphs that were not rasterized at any size yet are loaded. Tasks are only added, so that their
+	// vectors keep the memory from the previous batches.
+	int taskCount = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const GlyphRequest& request = requests[i];
+		GlyphKey key = GetGlyphKey(request.glyphIndex, request.faceId, font, dpi);
+		Glyph* cached = m_glyphs.Find(key);
+		if (cached != nullptr)
+		{
+			// keeps the band of the glyph from being evicted by the rest of the batch
+			TouchGlyph(*cached);
+			continue;
 		}
-		if (m_glyphs.size() == 0)
+		auto isSame = [&key](const RasterTask& task) { return memcmp(&task.key, &key, sizeof(GlyphKey)) == 0; };
+		if (std::find_if(m_rasterTasks.begin(), m_rasterTasks.begin() + taskCount, isSame) != m_rasterTasks.begin() + taskCount)
 		{
-			m_glyphs.insert(GlyphMap::value_type(hash, m_glyph));
-			lb = m_glyphs.find(hash);
+			continue;
 		}
-		else
+		const GlyphOutline& outline = m_outlineCache.Get(request.faceId, request.glyphIndex);
+		if (!outline.loaded)
+		{
+			// the replacement glyph is retrieved by RetrieveGlyph
+			continue;
+		}
+		if (taskCount == (int)m_rasterTasks.size())
+		{
+			m_rasterTasks.emplace_back();
+		}
+		RasterTask& task = m_rasterTasks[taskCount];
+		task.glyph = m_glyph;
+		FT_Face face = SetOutlineMetrics(outline, request.faceId, font, dpi, task.glyph);
+		task.key = key;
+		task.hasOutline = outline.isOutline;
+		if (task.hasOutline)
+		{
+			ScaleOutline(outline, face, task.points, task.outline);
+		}
+		++taskCount;
+	}
+
+	if (taskCount == 0)
+	{
+		return true;
+	}
+
+	// the kernel is selected on first use, do it before the workers race for it
+	detail::GetSDFKernel();
+
+	// One glyph per task, the kernels themselves are single threaded. The workers of OpenMP persist between the
+	// parallel regions.
+	RasterMode::Enum mode = m_rasterMode;
+	SDFGenerator::Enum generator = m_sdfGenerator;
+	RasterTask* tasks = m_rasterTasks.data();
+#if SCRIBER_SDF_USE_OMP
+	#pragma omp parallel for schedule(dynamic) if(taskCount > 1)
+#endif
+	for (int i = 0; i < taskCount; ++i)
+	{
+		RasterTask& task = tasks[i];
+		RenderDistanceField(mode, generator, task.hasOutline ? &task.outline : nullptr, task.buffer, task.bitmap);
+	}
+
+	for (int i = 0; i < taskCount; ++i)
+	{
+		RasterTask& task = tasks[i];
+		if (!Stash(task.glyph, &task.bitmap, nullptr, font.userdata))
+		{
+			// the rest of the batch stays unstashed
+			return false;
+		}
+		m_glyphs.Insert(task.key, task.glyph);
+		if (stats != nullptr)
+		{
+			CountPrewarmed(task.glyph, *stats);
+		}
+	}
+	return true;
+}
+
+void GlyphBitmapStash::CountPrewarmed(const Glyph& glyph, PrewarmStats& stats) const
+{
+	// glyphs without a bitmap and those larger than a band take no room in the atlas
+	if (glyph.m_metrics.glyphSize.x != 0 && glyph.m_metrics.glyphSize.y != 0)
+	{
+		stats.atlasBytes += glyph.m_metrics.glyphSize.x * glyph.m_metrics.glyphSize.y * Image::GetBPP(m_atlasFormat);
+		++stats.glyphCount;
+	}
+}
+
+void GlyphBitmapStash::Prewarm(const uint32_t* codes, int count, const Font& font, u16vec2 dpi, PrewarmStats& stats)
+{
+	enum
+	{
+		k_batchSize = 256
+	};
+
+	stats.glyphCount = 0;
+	stats.atlasBytes = 0;
+	stats.atlasFull = false;
+
+	// the glyphs that are not stashed yet, each once
+	m_prewarmRequests.clear();
+	for (int i = 0; i < count; ++i)
+	{
+		FaceID faceId = m_fc->GetFaceIDFromCode(codes[i], font.preferred_tf, font.style);
+		GlyphID glyphIndex = FT_Get_Char_Index(m_fc->GetFace(faceId), codes[i]);
+		if (glyphIndex != 0 && m_glyphs.Find(GetGlyphKey(glyphIndex, faceId, font, dpi)) == nullptr)
+		{
+			m_prewarmRequests.push_back({glyphIndex, faceId});
+		}
+	}
+	auto less = [](const GlyphRequest& a, const GlyphRequest& b)
+	{
+		return a.faceId != b.faceId ? a.faceId < b.faceId : a.glyphIndex < b.glyphIndex;
+	};
+	auto same = [](const GlyphRequest& a, const GlyphRequest& b)
+	{
+		return a.faceId == b.faceId && a.glyphIndex == b.glyphIndex;
+	};
+	std::sort(m_prewarmRequests.begin(), m_prewarmRequests.end(), less);
+	m_prewarmRequests.erase(std::unique(m_prewarmRequests.begin(), m_prewarmRequests.end(), same), m_prewarmRequests.end());
+
+	// The glyphs stashed by the call are stamped with the frame, evicting their bands would undo it. Once only bands of
+	// the frame are left the atlas is full and the remaining glyphs are not rasterized, the batches bound the work
+	// done in vain for the last one.
+	m_prewarming = true;
+	int requestCount = (int)m_prewarmRequests.size();
+	for (int first = 0; first < requestCount && !stats.atlasFull; first += k_batchSize)
+	{
+		const GlyphRequest* batch = m_prewarmRequests.data() + first;
+		int batchSize = std::min((int)k_batchSize, requestCount - first);
+		if (m_rasterMode != RasterMode::Bitmap)
+		{
+			stats.atlasFull = !PrefetchGlyphs(batch, batchSize, font, dpi, &stats);
+			continue;
+		}
+		// bitmap glyphs are not prefetched, they are stashed one by one
+		for (int i = 0; i < batchSize && !stats.atlasFull; ++i)
 		{
-			lb = m_glyphs.insert(lb, GlyphMap::value_type(hash, m_glyph));
+			StashResult::Enum result = StashBitmapGlyph(batch[i].glyphIndex, batch[i].faceId, font, dpi);
+			if (result == StashResult::Stashed)
+			{
+				CountPrewarmed(m_glyphs.Insert(GetGlyphKey(batch[i].glyphIndex, batch[i].faceId, font, dpi), m_glyph), stats);
+			}
+			stats.atlasFull = result == StashResult::AtlasFull;
+		}
+	}
+	m_prewarming = false;
+}
+
+Glyph::Metrics GlyphBitmapStash::GetMetrics(GlyphID glyphIndex, FaceID faceId, const Font& font, u16vec2 dpi)
+{
+	bool hinted = m_rasterMode == RasterMode::Bitmap;
+	bool reference = !hinted && m_sdfReferenceSize != 0;
+	uint16_t height = reference ? m_sdfReferenceSize : font.height;
+	u16vec2 size_dpi = reference ? u16vec2(0) : dpi;
+
+	const Glyph::Metrics* cached = m_metrics.Get(faceId, glyphIndex, height, size_dpi, hinted);
+	if (cached == nullptr)
+	{
+		// RetrieveGlyph draws the replacement glyph instead
+		FaceID result = m_fc->GetFaceIDFromCode(0x25A1, font.preferred_tf, font.style);
+		FT_UInt replacementIndex = FT_Get_Char_Index(m_fc->GetFace(result), 0x25A1);
+		cached = m_metrics.Get(result, replacementIndex, height, size_dpi, hinted);
+	}
+
+	Glyph::Metrics metrics;
+	memset(&metrics, 0, sizeof(Glyph::Metrics));
+	if (cached == nullptr)
+	{
+		return metrics;
+	}
+	metrics = *cached;
+	if (reference)
+	{
+		float ratio = font.height * dpi.y / (72.0f * m_sdfReferenceSize);
+		metrics.horiAdvance.v = (int)std::lround(metrics.horiAdvance.v * ratio);
+		metrics.ascender.v = (int)std::lround(metrics.ascender.v * ratio);
+		metrics.descender.v = (int)std::lround(metrics.descender.v * ratio);
+		// the box is scaled and grown to whole pixels again
+		vec2 topLeft = vec2(metrics.horizontalBearing);
+		vec2 bottomRight = topLeft + vec2(float(metrics.glyphSize.x), -float(metrics.glyphSize.y));
+		ivec2 min = ivec2((int)std::floor(topLeft.x * ratio), (int)std::floor(bottomRight.y * ratio));
+		ivec2 max = ivec2((int)std::ceil(bottomRight.x * ratio), (int)std::ceil(topLeft.y * ratio));
+		metrics.horizontalBearing = i16vec2(min.x, max.y);
+		metrics.glyphSize = u16vec2(max - min);
+	}
+	return metrics;
+}
+
+int32_t GlyphBitmapStash::GetKerning(FaceID faceId, GlyphID left, GlyphID right, const Font& font, u16vec2 dpi)
+{
+	// glyphs retrieved with a reference size are kerned at that size too and scaled as their advances are
+	if (m_rasterMode == RasterMode::Bitmap || m_sdfReferenceSize == 0)
+	{
+		return m_kerning.Get(faceId, left, right, font.height, dpi);
+	}
+	int32_t kerning = m_kerning.Get(faceId, left, right, m_sdfReferenceSize, u16vec2(0));
+	float ratio = font.height * dpi.y / (72.0f * m_sdfReferenceSize);
+	return (int32_t)std::lround(kerning * ratio);
+}
+
+void GlyphBitmapStash::ScaleToFontSize(Glyph& glyph, const Font& font, u16vec2 dpi) const
+{
+	if (m_rasterMode == RasterMode::Bitmap || m_sdfReferenceSize == 0)
+	{
+		return;
+	}
+	float ratio = font.height * dpi.y / (72.0f * m_sdfReferenceSize);
+
+	glyph.m_metrics.horiAdvance.v = (int)std::lround(glyph.m_metrics.horiAdvance.v * ratio);
+	glyph.m_metrics.ascender.v = (int)std::lround(glyph.m_metrics.ascender.v * ratio);
+	glyph.m_metrics.descender.v = (int)std::lround(glyph.m_metrics.descender.v * ratio);
+	glyph.m_bitmapScale = (uint16_t)std::max(1l, std::lround(ratio * 256.0f));
+}
+
+void GlyphBitmapStash::SetSDFReferenceSize(uint16_t size)
+{
+	if (m_sdfReferenceSize != size)
+	{
+		m_sdfReferenceSize = size;
+		Purge();
+	}
+}
+
+void GlyphBitmapStash::SetRasterMode(RasterMode::Enum mode)
+{
+	if (m_rasterMode != mode)
+	{
+		m_rasterMode = mode;
+		Purge();
+		SetAtlasFormat(mode == RasterMode::MSDF ? Image::RGB8 : Image::R8);
+	}
+}
+
+void GlyphBitmapStash::SetAtlasFormat(Image::DataType format)
+{
+	if (m_atlasFormat != format)
+	{
+		// strings already drawn in this frame lose their glyphs, as when a band used in the frame is evicted
+		auto usedInFrame = [this](const AtlasBand& band) { return band.lastUsed == m_frame; };
+		if (std::any_of(m_bands.begin(), m_bands.end(), usedInFrame))
+		{
+			m_stats.occupancyAtOverflow = GetOccupancy();
+			++m_stats.overflowCount;
 		}
-		return lb->second;
-    }
+		m_atlasFormat = format;
+		Purge();
+		// the page limit may be lower for the new format
+		CreateBands(m_packerType);
+		m_renderAPI->SetTextureFormat(format);
+	}
 }
 
-void GlyphBitmapStash::Stash(Glyph& glyph, FT_BitmapGlyph bitmapGlyph, FT_BitmapGlyph outlineBitmapGlyph, UserData userdata)
+bool GlyphBitmapStash::Stash(Glyph& glyph, FT_BitmapGlyph bitmapGlyph, FT_BitmapGlyph outlineBitmapGlyph, UserData userdata)
 {
 	Image image;
 
@@ -186,9 +561,8 @@ void GlyphBitmapStash::Stash(Glyph& glyph, FT_BitmapGlyph bitmapGlyph, FT_Bitmap
 		FT_Bitmap& outlinebitmap = outlineBitmapGlyph->bitmap;
 		FT_Bitmap& fillbitmap = bitmapGlyph->bitmap;
 
-		ResizeBitmap(std::max(outlinebitmap.width, outlinebitmap.rows));
-
-		image = Image::FromMemory(m_bitmap, Image::RG8, ivec2(outlinebitmap.width, outlinebitmap.rows), 1);
+		// the fill does not cover the whole outline, the rest of its channel has to be zero
+		image = GetStagingImage(ivec2(outlinebitmap.width, outlinebitmap.rows), true);
 		Image fill = Image::FromMemory(fillbitmap.buffer, Image::R8, ivec2(fillbitmap.width, fillbitmap.rows), 1);
 		Image outline = Image::FromMemory(outlinebitmap.buffer, Image::R8, ivec2(outlinebitmap.width, outlinebitmap.rows), 1);
 
@@ -203,13 +577,24 @@ void GlyphBitmapStash::Stash(Glyph& glyph, FT_BitmapGlyph bitmapGlyph, FT_Bitmap
 		glyph.m_metrics.horizontalBearing.x = outlineBitmapGlyph->left;
 		glyph.m_metrics.horizontalBearing.y = outlineBitmapGlyph->top;
 	}
-	else
+	else if (m_atlasFormat != Image::RG8)
 	{
 		FT_Bitmap& bitmap = bitmapGlyph->bitmap;
 
-		ResizeBitmap(std::max(bitmap.width, bitmap.rows));
+		// fill or distance field in an R8 atlas, or MSDF already interleaved, no need for staging
+		image = Image::FromMemory(bitmap.buffer, m_atlasFormat, ivec2(bitmap.width, bitmap.rows), 1);
 
-		image = Image::FromMemory(m_bitmap, Image::RG8, ivec2(bitmap.width, bitmap.rows), 1);
+		glyph.m_metrics.glyphSize.x = bitmap.width;
+		glyph.m_metrics.glyphSize.y = bitmap.rows;
+		glyph.m_metrics.horizontalBearing.x = bitmapGlyph->left;
+		glyph.m_metrics.horizontalBearing.y = bitmapGlyph->top;
+	}
+	else
+	{
+		// the atlas has the outline channel of stroked glyphs
+		FT_Bitmap& bitmap = bitmapGlyph->bitmap;
+
+		image = GetStagingImage(ivec2(bitmap.width, bitmap.rows), false);
 		Image fill = Image::FromMemory(bitmap.buffer, Image::R8, ivec2(bitmap.width, bitmap.rows), 1);
 		image.AssignToChannelZeroOther(fill, 0);
 
@@ -221,37 +606,887 @@ void GlyphBitmapStash::Stash(Glyph& glyph, FT_BitmapGlyph bitmapGlyph, FT_Bitmap
 		glyph.m_metrics.horizontalBearing.y = bitmapGlyph->top;
 	}
 
+	// glyphs without a bitmap do not keep the atlas position of the glyph they were copied from
 	if (bitmapGlyph->bitmap.buffer == nullptr)
-		return;
+	{
+		glyph.m_cacheUV = u16vec2(0);
+		glyph.m_cachePage = 0;
+		return true;
+	}
+
+	// the packers work on the atlas without its top and left border, each glyph reserves the spacing on its right and bottom
+	ivec2 size = ivec2(glyph.m_metrics.glyphSize) + ivec2(m_spacing);
+	ivec2 position;
+	int band = Place(size, position);
+	if (band == k_atlasFull)
+	{
+		return false;
+	}
+	if (band < 0)
+	{
+		// drawn as nothing
+		glyph.m_metrics.glyphSize = u16vec2(0);
+		glyph.m_cacheUV = u16vec2(0);
+		glyph.m_cachePage = 0;
+		return true;
+	}
+	m_bands[band].usedArea += glyph.m_metrics.glyphSize.x * glyph.m_metrics.glyphSize.y;
+	m_bands[band].lastUsed = m_frame;
+	m_bands[band].sizes.push_back(size);
+
+	glyph.m_cacheUV = u16vec2(position + ivec2(0, band % m_bandsPerPage * m_bandHeight) + ivec2(m_spacing));
+	glyph.m_cachePage = uint16_t(band / m_bandsPerPage);
+	UpdateAtlas(band, image, glyph.m_cacheUV);
+
+	//m_renderAPI->SaveTextureToFile();
+	return true;
+}
+
 
-	if (glyph.m_metrics.glyphSize.x + m_currentPos.x + m_spacing >= m_stashTextureSize.x)
+int GlyphBitmapStash::Place(ivec2 size, ivec2& position)
+{
+	if (size.x > m_stashTextureSize.x - m_spacing || size.y > m_bandHeight)
+	{
+		return -1;
+	}
+	for (int i = 0; i < (int)m_bands.size(); ++i)
 	{
-		m_currentPos.x = m_spacing;
-		m_currentPos.y = m_maxHeight + m_spacing;
+		if (m_bands[i].packer->Insert(size, position))
+		{
+			return i;
+		}
 	}
-	m_maxHeight = std::max(m_maxHeight, (uint16_t)(m_currentPos.y + glyph.m_metrics.glyphSize.y));
 
-	if (m_maxHeight > m_stashTextureSize.y)
+	if ((int)m_bands.size() / m_bandsPerPage < GetMaxPages(m_atlasFormat))
 	{
-		Purge();
-		m_was_overflowed = true;
+		int first = (int)m_bands.size();
+		AddPage();
+		m_bands[first].packer->Insert(size, position);
+		return first;
 	}
 
-	glyph.m_cacheUV = m_currentPos;
-	m_renderAPI->UpdateTexture(image, m_currentPos);
+	// the least recently used band, of those with the same stamp the one that was filled first
+	int lru = 0;
+	for (int i = 1; i < (int)m_bands.size(); ++i)
+	{
+		const AtlasBand& band = m_bands[i];
+		const AtlasBand& best = m_bands[lru];
+		if (band.lastUsed < best.lastUsed || (band.lastUsed == best.lastUsed && band.evictedAt < best.evictedAt))
+		{
+			lru = i;
+		}
+	}
 
-	m_currentPos.x += glyph.m_metrics.glyphSize.x + m_spacing;
+	// strings already drawn in this frame may reference the band
+	if (m_bands[lru].lastUsed == m_frame)
+	{
+		if (m_prewarming)
+		{
+			return k_atlasFull;
+		}
+		m_stats.occupancyAtOverflow = GetOccupancy();
+		++m_stats.overflowCount;
+	}
 
-	//m_renderAPI->SaveTextureToFile();
+	EvictBand(lru);
+	m_bands[lru].packer->Insert(size, position);
+	return lru;
 }
 
+void GlyphBitmapStash::EvictBand(int band)
+{
+	m_glyphs.EraseIf([this, band](const Glyph& glyph) { return GetBand(glyph) == band; });
+	ResetBand(band);
+	++m_stats.evictionCount;
 
-void GlyphBitmapStash::Purge()
+	ivec2 size = ivec2(m_stashTextureSize.x - m_spacing, m_bandHeight);
+	ivec2 pos = ivec2(0, band % m_bandsPerPage * m_bandHeight) + ivec2(m_spacing);
+	ClearAtlas(band / m_bandsPerPage, pos, size);
+}
+
+void GlyphBitmapStash::ResetBand(int band)
 {
-	m_glyphs.clear();
-	m_currentPos = u16vec2(m_spacing);
-	m_maxHeight = m_spacing;
+	AtlasBand& b = m_bands[band];
+	b.packer->Clear();
+	b.usedArea = 0;
+	b.sizes.clear();
+	b.evictedAt = ++m_evictions;
+}
 
-	m_renderAPI->ClearTexture();
+void GlyphBitmapStash::ClearAtlas(int page, ivec2 pos, ivec2 size)
+{
+	if (m_uploadPerGlyph)
+	{
+		Image empty = Image::Empty(size, m_atlasFormat, 1);
+		m_renderAPI->UpdateTexture(uint16_t(page), empty, u16vec2(pos));
+	}
+	else
+	{
+		m_shadowPages[page].OpenView(pos, size).Clear();
+		MarkDirty(page, pos, size);
+	}
+}
+
+void GlyphBitmapStash::UpdateAtlas(int band, Image image, u16vec2 pos)
+{
+	if (m_uploadPerGlyph)
+	{
+		m_renderAPI->UpdateTexture(uint16_t(band / m_bandsPerPage), image, pos);
+		return;
+	}
+	m_shadowPages[band / m_bandsPerPage].OpenView(ivec2(pos), image.GetSize()).Assign(image);
+	MarkDirty(band / m_bandsPerPage, ivec2(pos), image.GetSize());
+}
+
+static int Area(ivec2 min, ivec2 max)
+{
+	return (max.x - min.x) * (max.y - min.y);
+}
+
+void GlyphBitmapStash::MarkDirty(int page, ivec2 pos, ivec2 size)
+{
+	enum
+	{
+		k_maxDirtyRects = 32
+	};
+
+	DirtyRect rect = {page, pos, pos + size};
+
+	// A merged rectangle may now be worth merging with another one, so it is taken out and added again. Rectangles
+	// packed next to each other join with little waste, a rectangle inside another one with none.
+	for (bool merged = true; merged;)
+	{
+		merged = false;
+		int best = -1;
+		int bestWaste = 0;
+		for (int i = 0; i < (int)m_dirtyRects.size(); ++i)
+		{
+			const DirtyRect& other = m_dirtyRects[i];
+			if (other.page != page)
+			{
+				continue;
+			}
+			int area = Area(rect.min, rect.max) + Area(other.min, other.max);
+			int waste = Area(min(rect.min, other.min), max(rect.max, other.max)) - area;
+			if ((waste * 4 <= area || (int)m_dirtyRects.size() >= k_maxDirtyRects) && (best < 0 || waste < bestWaste))
+			{
+				best = i;
+				bestWaste = waste;
+			}
+		}
+		if (best >= 0)
+		{
+			rect.min = min(rect.min, m_dirtyRects[best].min);
+			rect.max = max(rect.max, m_dirtyRects[best].max);
+			m_dirtyRects[best] = m_dirtyRects.back();
+			m_dirtyRects.pop_back();
+			merged = true;
+		}
+	}
+	m_dirtyRects.push_back(rect);
 }
 
+void GlyphBitmapStash::FlushUploads()
+{
+	if (m_uploadPerGlyph)
+	{
+		return;
+	}
+
+	m_regions.clear();
+	for (const DirtyRect& rect : m_dirtyRects)
+	{
+		TextureRegion region = {uint16_t(rect.page), u16vec2(rect.min), m_shadowPages[rect.page].OpenView(rect.min, rect.max - rect.min)};
+		m_regions.push_back(region);
+	}
+	m_dirtyRects.clear();
+
+	if (m_regions.empty() || m_renderAPI->UpdateTextureRegions(m_regions.data(), (int)m_regions.size()))
+	{
+		return;
+	}
+
+	// the backend only takes single images, there is no need for the copy of the atlas anymore
+	for (const TextureRegion& region : m_regions)
+	{
+		m_renderAPI->UpdateTexture(region.page, region.image, region.pos);
+	}
+	m_regions.clear();
+	m_shadowPages.clear();
+	m_uploadPerGlyph = true;
+}
+
+void GlyphBitmapStash::StartCompaction()
+{
+	m_compacting = true;
+	m_compactDone = 0;
+}
+
+static uint64_t AtlasPosition(uint16_t page, u16vec2 uv)
+{
+	return uint64_t(page) << 32 | uint32_t(uv.x) << 16 | uv.y;
+}
+
+bool GlyphBitmapStash::IsLive(const Glyph& glyph) const
+{
+	return std::binary_search(m_live.begin(), m_live.end(), AtlasPosition(glyph.m_cachePage, glyph.m_cacheUV));
+}
+
+void GlyphBitmapStash::StepCompaction(const Vertex* vertices, int vertexCount)
+{
+	if (!m_compacting)
+	{
+		return;
+	}
+
+	// without a copy of the atlas the glyphs can only be moved by the backend
+	if (m_uploadPerGlyph && !m_renderAPI->CopyTextureRegions(nullptr, 0))
+	{
+		m_compacting = false;
+		return;
+	}
+
+	// the first vertex of a quad has the position of the glyph in the atlas, the quads of glyphs without a bitmap
+	// have no size there
+	m_live.clear();
+	for (int i = 0; i < vertexCount; i += 4)
+	{
+		if (vertices[i].uv != vertices[i + 3].uv)
+		{
+			m_live.push_back(AtlasPosition(vertices[i].page, vertices[i].uv));
+		}
+	}
+	std::sort(m_live.begin(), m_live.end());
+	m_live.erase(std::unique(m_live.begin(), m_live.end()), m_live.end());
+
+	m_liveArea.assign(m_bands.size(), 0);
+	m_glyphs.ForEach([this](const GlyphKey&, const Glyph& glyph)
+	{
+		int band = GetBand(glyph);
+		if (band >= 0 && IsLive(glyph))
+		{
+			m_liveArea[band] += glyph.m_metrics.glyphSize.x * glyph.m_metrics.glyphSize.y;
+		}
+	});
+
+	// The band with the least live glyphs, of those that are at most half live. Bands that were not drawn at all are
+	// left to eviction.
+	int source = -1;
+	for (int i = 0; i < (int)m_bands.size(); ++i)
+	{
+		const AtlasBand& band = m_bands[i];
+		uint64_t live = m_liveArea[i];
+		if ((m_compactDone & (uint64_t(1) << i)) == 0 && live != 0 && live * 2 <= band.usedArea && (source < 0 || live < m_liveArea[source]))
+		{
+			source = i;
+		}
+	}
+	if (source < 0)
+	{
+		m_compacting = false;
+		return;
+	}
+
+	// a band that does not fit is not tried again, a moved one is empty
+	if (!MoveBand(source))
+	{
+		m_compactDone |= uint64_t(1) << source;
+	}
+}
+
+bool GlyphBitmapStash::MoveBand(int band)
+{
+	m_compactGlyphs.clear();
+	m_glyphs.ForEach([this, band](const GlyphKey&, Glyph& glyph)
+	{
+		if (GetBand(glyph) == band && IsLive(glyph))
+		{
+			m_compactGlyphs.push_back(&glyph);
+		}
+	});
+	std::sort(m_compactGlyphs.begin(), m_compactGlyphs.end(), [](const Glyph* a, const Glyph* b)
+	{
+		const u16vec2& sa = a->m_metrics.glyphSize;
+		const u16vec2& sb = b->m_metrics.glyphSize;
+		return sa.y != sb.y ? sa.y > sb.y : sa.x > sb.x;
+	});
+
+	// the other bands, fullest first, so that the sparse ones stay empty enough to be moved next. Empty ones come last.
+	m_compactTargets.clear();
+	for (int i = 0; i < (int)m_bands.size(); ++i)
+	{
+		if (i != band)
+		{
+			m_compactTargets.push_back(i);
+		}
+	}
+	std::sort(m_compactTargets.begin(), m_compactTargets.end(), [this](int a, int b)
+	{
+		return m_bands[a].usedArea > m_bands[b].usedArea;
+	});
+
+	// The packers of the targets are rebuilt from their rectangles when first needed. They only replace those of the
+	// bands if all the glyphs fit.
+	m_compactPackers.resize(m_bands.size());
+	m_compactReplayed.assign(m_bands.size(), false);
+	m_copies.clear();
+	for (const Glyph* glyph : m_compactGlyphs)
+	{
+		ivec2 size = ivec2(glyph->m_metrics.glyphSize) + ivec2(m_spacing);
+		ivec2 position;
+		int target = -1;
+		for (int i = 0; i < (int)m_compactTargets.size() && target < 0; ++i)
+		{
+			int candidate = m_compactTargets[i];
+			IAtlasPackerPtr& packer = m_compactPackers[candidate];
+			if (!m_compactReplayed[candidate])
+			{
+				if (!packer)
+				{
+					packer = CreateAtlasPacker(m_packerType, ivec2(m_stashTextureSize.x - m_spacing, m_bandHeight));
+				}
+				packer->Clear();
+				for (ivec2 placed : m_bands[candidate].sizes)
+				{
+					packer->Insert(placed, position);
+				}
+				m_compactReplayed[candidate] = true;
+			}
+			if (packer->Insert(size, position))
+			{
+				target = candidate;
+			}
+		}
+		if (target < 0)
+		{
+			return false;
+		}
+		ivec2 offset = ivec2(0, target % m_bandsPerPage * m_bandHeight) + ivec2(m_spacing);
+		TextureCopy copy = {glyph->m_cachePage, glyph->m_cacheUV, uint16_t(target / m_bandsPerPage), u16vec2(position + offset), glyph->m_metrics.glyphSize};
+		m_copies.push_back(copy);
+	}
+
+	bool copied = m_renderAPI->CopyTextureRegions(m_copies.data(), (int)m_copies.size());
+	if (!m_uploadPerGlyph)
+	{
+		// the copy of the atlas stays the same as the texture, it is uploaded if the backend did not copy
+		for (const TextureCopy& copy : m_copies)
+		{
+			Image source = m_shadowPages[copy.srcPage].OpenView(ivec2(copy.srcPos), ivec2(copy.size));
+			m_shadowPages[copy.dstPage].OpenView(ivec2(copy.dstPos), ivec2(copy.size)).Assign(source);
+			if (!copied)
+			{
+				MarkDirty(copy.dstPage, ivec2(copy.dstPos), ivec2(copy.size));
+			}
+		}
+	}
+	for (size_t i = 0; i < m_compactGlyphs.size(); ++i)
+	{
+		Glyph& glyph = *m_compactGlyphs[i];
+		glyph.m_cachePage = m_copies[i].dstPage;
+		glyph.m_cacheUV = m_copies[i].dstPos;
+		AtlasBand& target = m_bands[GetBand(glyph)];
+		target.sizes.push_back(ivec2(glyph.m_metrics.glyphSize) + ivec2(m_spacing));
+		target.usedArea += glyph.m_metrics.glyphSize.x * glyph.m_metrics.glyphSize.y;
+		target.lastUsed = std::max(target.lastUsed, m_bands[band].lastUsed);
+	}
+	for (int target : m_compactTargets)
+	{
+		if (m_compactReplayed[target])
+		{
+			std::swap(m_bands[target].packer, m_compactPackers[target]);
+		}
+	}
+	m_stats.relocationCount += (uint32_t)m_compactGlyphs.size();
+
+	// the glyphs that were not drawn are dropped, only the glyphs are cleared as the rest of the band is empty already
+	m_glyphs.EraseIf([this, band](const Glyph& glyph)
+	{
+		if (GetBand(glyph) != band)
+		{
+			return false;
+		}
+		ClearAtlas(glyph.m_cachePage, ivec2(glyph.m_cacheUV), ivec2(glyph.m_metrics.glyphSize));
+		return true;
+	});
+	for (const TextureCopy& copy : m_copies)
+	{
+		ClearAtlas(copy.srcPage, ivec2(copy.srcPos), ivec2(copy.size));
+	}
+	ResetBand(band);
+	return true;
+}
+
+int GlyphBitmapStash::GetBand(const Glyph& glyph) const
+{
+	if (glyph.m_metrics.glyphSize.x == 0 || glyph.m_metrics.glyphSize.y == 0)
+	{
+		return -1;
+	}
+	return glyph.m_cachePage * m_bandsPerPage + (glyph.m_cacheUV.y - m_spacing) / m_bandHeight;
+}
+
+void GlyphBitmapStash::TouchGlyph(const Glyph& glyph)
+{
+	int band = GetBand(glyph);
+	if (band >= 0)
+	{
+		m_bands[band].lastUsed = m_frame;
+	}
+}
+
+AtlasUse GlyphBitmapStash::GetAtlasUse(const GlyphString& glyphs, uint32_t stamp) const
+{
+	AtlasUse use = {0, stamp};
+	for (const Glyph& glyph : glyphs)
+	{
+		int band = GetBand(glyph);
+		if (band >= 0)
+		{
+			use.bands |= uint64_t(1) << band;
+		}
+	}
+	return use;
+}
+
+bool GlyphBitmapStash::IsResident(const AtlasUse& use) const
+{
+	for (int i = 0; i < (int)m_bands.size(); ++i)
+	{
+		if ((use.bands & (uint64_t(1) << i)) != 0 && m_bands[i].evictedAt > use.stamp)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void GlyphBitmapStash::Touch(const AtlasUse& use)
+{
+	for (int i = 0; i < (int)m_bands.size(); ++i)
+	{
+		if ((use.bands & (uint64_t(1) << i)) != 0)
+		{
+			m_bands[i].lastUsed = m_frame;
+		}
+	}
+}
+
+void GlyphBitmapStash::CreateBands(AtlasPacker::Enum packer)
+{
+	// bands of about 128 pixels, at most 64 on all pages so that a string can keep its bands in a mask. Glyphs taller
+	// than a band are not stashed.
+	ivec2 area = m_stashTextureSize - ivec2(m_spacing);
+	m_packerType = packer;
+	m_bandsPerPage = std::min(64, std::max(1, area.y / 128));
+	m_bandHeight = area.y / m_bandsPerPage;
+
+	m_bands.clear();
+	m_shadowPages.clear();
+	m_compacting = false;
+	m_compactPackers.clear();
+	AddPage();
+}
+
+void GlyphBitmapStash::AddPage()
+{
+	ivec2 area = m_stashTextureSize - ivec2(m_spacing);
+	for (int i = 0; i < m_bandsPerPage; ++i)
+	{
+		AtlasBand band;
+		band.packer = CreateAtlasPacker(m_packerType, ivec2(area.x, m_bandHeight));
+		band.usedArea = 0;
+		band.lastUsed = 0;
+		band.evictedAt = m_evictions;
+		m_bands.push_back(std::move(band));
+	}
+	m_renderAPI->SetTexturePageCount((int)m_bands.size() / m_bandsPerPage);
+	if (!m_uploadPerGlyph)
+	{
+		m_shadowPages.push_back(Image::Empty(m_stashTextureSize, m_atlasFormat, 1));
+	}
+}
+
+int GlyphBitmapStash::GetMaxPages(Image::DataType format) const
+{
+	int maxPages = std::min(m_maxPages, 64 / m_bandsPerPage);
+	if (m_maxPageBytes != 0)
+	{
+		size_t pageBytes = size_t(m_stashTextureSize.x) * m_stashTextureSize.y * Image::GetBPP(format);
+		maxPages = std::min(maxPages, int(m_maxPageBytes / pageBytes));
+	}
+	return std::max(1, maxPages);
+}
+
+void GlyphBitmapStash::SetAtlasPacker(AtlasPacker::Enum packer)
+{
+	Purge();
+	CreateBands(packer);
+}
+
+int GlyphBitmapStash::SetAtlasPages(int maxPages, size_t maxBytes)
+{
+	m_maxPages = maxPages;
+	m_maxPageBytes = maxBytes;
+	Purge();
+	CreateBands(m_packerType);
+	return GetMaxPages(m_atlasFormat);
+}
+
+float GlyphBitmapStash::GetOccupancy() const
+{
+	uint64_t usedArea = 0;
+	for (const AtlasBand& band : m_bands)
+	{
+		usedArea += band.usedArea;
+	}
+	int pages = (int)m_bands.size() / m_bandsPerPage;
+	return float(usedArea) / (float(m_stashTextureSize.x * m_stashTextureSize.y) * pages);
+}
+
+AtlasStats GlyphBitmapStash::GetAtlasStats() const
+{
+	AtlasStats stats = m_stats;
+	stats.occupancy = GetOccupancy();
+	stats.pageCount = (int)m_bands.size() / m_bandsPerPage;
+	return stats;
+}
+
+void GlyphBitmapStash::Purge()
+{
+	m_compacting = false;
+	m_glyphs.Clear();
+	++m_evictions;
+	for (AtlasBand& band : m_bands)
+	{
+		band.packer->Clear();
+		band.sizes.clear();
+		band.usedArea = 0;
+		band.evictedAt = m_evictions;
+	}
+	m_dirtyRects.clear();
+	for (Image& page : m_shadowPages)
+	{
+		page.Clear();
+	}
+
+	m_renderAPI->ClearTexture();
+}
+
+namespace
+{
+	enum
+	{
+		k_atlasFileMagic = 0x41524353, // SCRA
+		// bump when the layout of the file or the parameters of the rasterizers change
+		k_atlasFileVersion = 1
+	};
+
+	// Followed by the faces, the bands, the rectangles of the bands' packers, the glyphs and the rows of the pages, all
+	// covered by the payload hash. Fields are stored as they are in memory, files only go to the same build.
+	struct AtlasFileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t payloadSize;
+		uint64_t payloadHash;
+		uint32_t glyphRecordSize;
+		int32_t textureSizeX;
+		int32_t textureSizeY;
+		int32_t spacing;
+		int32_t bandsPerPage;
+		int32_t bandHeight;
+		int32_t pageCount;
+		uint32_t faceCount;
+		uint32_t rectCount;
+		uint32_t glyphCount;
+		uint16_t sdfReferenceSize;
+		uint8_t rasterMode;
+		uint8_t sdfGenerator;
+		uint8_t packer;
+		uint8_t format;
+		uint8_t padding[2];
+	};
+
+	struct AtlasFileFace
+	{
+		uint64_t contentHash;
+		uint32_t faceId;
+		uint32_t padding;
+	};
+
+	struct AtlasFileBand
+	{
+		uint64_t usedArea;
+		uint32_t rectCount;
+		uint32_t padding;
+	};
+
+	struct AtlasFileGlyph
+	{
+		GlyphKey key;
+		Glyph glyph;
+	};
+
+	template<typename T>
+	void Append(std::vector<uint8_t>& buffer, const T& value)
+	{
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(&value);
+		buffer.insert(buffer.end(), data, data + sizeof(T));
+	}
+
+	// Reads the payload front to back, false once it runs past the end
+	struct PayloadReader
+	{
+		const uint8_t* data;
+		const uint8_t* end;
+
+		template<typename T>
+		bool Read(T& value)
+		{
+			if (size_t(end - data) < sizeof(T))
+			{
+				return false;
+			}
+			memcpy(&value, data, sizeof(T));
+			data += sizeof(T);
+			return true;
+		}
+	};
+}
+
+bool GlyphBitmapStash::SaveAtlas(const char* path)
+{
+	// the pixels come from the copy of the atlas
+	if (m_uploadPerGlyph)
+	{
+		return false;
+	}
+
+	std::vector<FaceID> faces;
+	std::vector<uint64_t> hashes;
+	std::vector<AtlasFileGlyph> glyphs;
+	glyphs.reserve(m_glyphs.Size());
+	m_glyphs.ForEach([&](const GlyphKey& key, const Glyph& glyph)
+	{
+		auto face = std::find(faces.begin(), faces.end(), key.faceId);
+		if (face == faces.end())
+		{
+			faces.push_back(key.faceId);
+			hashes.push_back(m_fc->GetContentHash(key.faceId));
+			face = faces.end() - 1;
+		}
+		// a face that cannot be hashed cannot be recognized when loading
+		if (hashes[face - faces.begin()] != 0)
+		{
+			AtlasFileGlyph record;
+			memset(&record, 0, sizeof(AtlasFileGlyph));
+			record.key = key;
+			record.glyph = glyph;
+			glyphs.push_back(record);
+		}
+	});
+
+	AtlasFileHeader header;
+	memset(&header, 0, sizeof(AtlasFileHeader));
+	header.magic = k_atlasFileMagic;
+	header.version = k_atlasFileVersion;
+	header.glyphRecordSize = sizeof(AtlasFileGlyph);
+	header.textureSizeX = m_stashTextureSize.x;
+	header.textureSizeY = m_stashTextureSize.y;
+	header.spacing = m_spacing;
+	header.bandsPerPage = m_bandsPerPage;
+	header.bandHeight = m_bandHeight;
+	header.pageCount = (int)m_shadowPages.size();
+	header.sdfReferenceSize = m_sdfReferenceSize;
+	header.rasterMode = m_rasterMode;
+	header.sdfGenerator = m_sdfGenerator;
+	header.packer = m_packerType;
+	header.format = (uint8_t)m_atlasFormat;
+	header.glyphCount = (uint32_t)glyphs.size();
+
+	std::vector<uint8_t>& payload = m_fileBuffer;
+	payload.clear();
+	for (size_t i = 0; i < faces.size(); ++i)
+	{
+		if (hashes[i] != 0)
+		{
+			AtlasFileFace face = {hashes[i], faces[i], 0};
+			Append(payload, face);
+			++header.faceCount;
+		}
+	}
+	for (const AtlasBand& band : m_bands)
+	{
+		AtlasFileBand record = {band.usedArea, (uint32_t)band.sizes.size(), 0};
+		Append(payload, record);
+		header.rectCount += record.rectCount;
+	}
+	for (const AtlasBand& band : m_bands)
+	{
+		for (ivec2 size : band.sizes)
+		{
+			Append(payload, size);
+		}
+	}
+	for (const AtlasFileGlyph& glyph : glyphs)
+	{
+		Append(payload, glyph);
+	}
+	for (const Image& page : m_shadowPages)
+	{
+		size_t rowSize = page.GetSize().x * page.GetBPP();
+		for (int y = 0; y < page.GetSize().y; ++y)
+		{
+			const uint8_t* row = page.GetRow<uint8_t>(y);
+			payload.insert(payload.end(), row, row + rowSize);
+		}
+	}
+	header.payloadSize = payload.size();
+	header.payloadHash = XXH64(payload.data(), payload.size(), 0);
+
+	UserFile* file = detail::io::Open(path, "wb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	bool written = detail::io::Write(&header, sizeof(AtlasFileHeader), 1, file) == 1
+			&& detail::io::Write(payload.data(), payload.size(), 1, file) == 1;
+	written = detail::io::Close(file) == 0 && written;
+	return written;
+}
+
+bool GlyphBitmapStash::LoadAtlas(const char* path)
+{
+	UserFile* file = detail::io::Open(path, "rb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	detail::io::Seek(file, 0, SEEK_END);
+	long fileSize = detail::io::Tell(file);
+	detail::io::Seek(file, 0, SEEK_SET);
+	AtlasFileHeader header;
+	bool read = detail::io::Read(&header, sizeof(AtlasFileHeader), 1, file) == 1
+			&& header.magic == k_atlasFileMagic
+			&& header.version == k_atlasFileVersion
+			&& header.payloadSize == uint64_t(fileSize) - sizeof(AtlasFileHeader);
+	if (read)
+	{
+		m_fileBuffer.resize(size_t(header.payloadSize));
+		read = detail::io::Read(m_fileBuffer.data(), 1, m_fileBuffer.size(), file) == m_fileBuffer.size();
+	}
+	detail::io::Close(file);
+
+	// stale files, saved with other settings, and damaged ones are ignored
+	bool bitmapFormat = header.format == Image::R8 || header.format == Image::RG8;
+	bool valid = read
+			&& header.glyphRecordSize == sizeof(AtlasFileGlyph)
+			&& header.textureSizeX == m_stashTextureSize.x
+			&& header.textureSizeY == m_stashTextureSize.y
+			&& header.spacing == m_spacing
+			&& header.bandsPerPage == m_bandsPerPage
+			&& header.bandHeight == m_bandHeight
+			&& header.rasterMode == m_rasterMode
+			&& header.sdfReferenceSize == m_sdfReferenceSize
+			&& header.sdfGenerator == m_sdfGenerator
+			&& header.packer == m_packerType
+			&& (header.format == m_atlasFormat || (m_rasterMode == RasterMode::Bitmap && bitmapFormat))
+			&& header.pageCount >= 1
+			&& header.pageCount <= GetMaxPages(Image::DataType(header.format));
+	// the sections have the sizes the header gives
+	Image::DataType format = Image::DataType(header.format);
+	size_t pageSize = size_t(m_stashTextureSize.x) * m_stashTextureSize.y * Image::GetBPP(format);
+	size_t bandCount = size_t(header.pageCount) * m_bandsPerPage;
+	valid = valid && header.payloadSize == header.faceCount * sizeof(AtlasFileFace) + bandCount * sizeof(AtlasFileBand)
+			+ header.rectCount * sizeof(ivec2) + header.glyphCount * sizeof(AtlasFileGlyph) + header.pageCount * pageSize;
+	valid = valid && XXH64(m_fileBuffer.data(), m_fileBuffer.size(), 0) == header.payloadHash;
+	if (!valid)
+	{
+		return false;
+	}
+
+	// the faces are matched by the content of their files, the ids may differ between runs
+	PayloadReader reader = {m_fileBuffer.data(), m_fileBuffer.data() + m_fileBuffer.size()};
+	std::vector<FaceID> loadedFaces;
+	m_fc->GetFaceIDs(loadedFaces);
+	std::vector<std::pair<FaceID, FaceID> > faceMap;
+	for (uint32_t i = 0; i < header.faceCount; ++i)
+	{
+		AtlasFileFace face;
+		reader.Read(face);
+		auto match = std::find_if(loadedFaces.begin(), loadedFaces.end(), [this, &face](FaceID id) { return m_fc->GetContentHash(id) == face.contentHash; });
+		if (match == loadedFaces.end())
+		{
+			return false;
+		}
+		faceMap.push_back(std::make_pair(FaceID(face.faceId), *match));
+	}
+	std::vector<AtlasFileBand> bands(bandCount);
+	uint64_t rectCount = 0;
+	for (AtlasFileBand& band : bands)
+	{
+		reader.Read(band);
+		rectCount += band.rectCount;
+	}
+	if (rectCount != header.rectCount)
+	{
+		return false;
+	}
+
+	if (format != m_atlasFormat)
+	{
+		SetAtlasFormat(format);
+	}
+	Purge();
+	CreateBands(m_packerType);
+	while (m_bands.size() < bandCount)
+	{
+		AddPage();
+	}
+
+	// the packers are rebuilt by inserting the same rectangles in the same order
+	for (size_t i = 0; i < bandCount; ++i)
+	{
+		AtlasBand& band = m_bands[i];
+		band.usedArea = bands[i].usedArea;
+		for (uint32_t j = 0; j < bands[i].rectCount; ++j)
+		{
+			ivec2 size;
+			ivec2 position;
+			reader.Read(size);
+			band.packer->Insert(size, position);
+			band.sizes.push_back(size);
+		}
+	}
+	for (uint32_t i = 0; i < header.glyphCount; ++i)
+	{
+		AtlasFileGlyph record;
+		reader.Read(record);
+		for (const auto& face : faceMap)
+		{
+			if (face.first == record.key.faceId)
+			{
+				record.key.faceId = face.second;
+				break;
+			}
+		}
+		m_glyphs.Insert(record.key, record.glyph);
+	}
+
+	// the pages go to the texture in one upload each
+	for (int page = 0; page < header.pageCount; ++page)
+	{
+		Image pixels = Image::FromMemory(reader.data + pageSize * page, m_atlasFormat, m_stashTextureSize, 1);
+		if (m_uploadPerGlyph)
+		{
+			m_renderAPI->UpdateTexture(uint16_t(page), pixels, u16vec2(0));
+		}
+		else
+		{
+			m_shadowPages[page].Assign(pixels);
+			MarkDirty(page, ivec2(0), m_stashTextureSize);
+		}
+	}
+	return true;
+}
@@ -2,7 +2,12 @@
 #include "Scriber.h"
 #include "Glyph.h"
 #include "IRenderAPI.h"
-#include <map>
+#include "OutlineCache.h"
+#include "KerningCache.h"
+#include "GlyphMetricsCache.h"
+#include "AtlasPacker.h"
+#include "GlyphTable.h"
+#include <vector>
 
 typedef struct FT_BitmapGlyphRec_*  FT_BitmapGlyph;
 
@@ -10,6 +15,21 @@ namespace Scriber
 {
 	class FaceCollection;
 
+	struct GlyphRequest
+	{
+		GlyphID glyphIndex;
+		FaceID faceId;
+	};
+
+	// Bands of the atlas a glyph string has glyphs in, and the number of evictions when it was formatted
+	struct AtlasUse
+	{
+		uint64_t bands;
+		uint32_t stamp;
+	};
+
+	// The atlas is split into horizontal bands, each with its own packer. When a glyph does not fit, a new atlas page is
+	// added while the page limit allows, otherwise the least recently used band is evicted instead of the whole atlas.
 	class GlyphBitmapStash
 	{
 	public:
@@ -21,31 +41,233 @@ namespace Scriber
 
 		void Purge();
 
-		Glyph& RetrieveGlyph(GlyphID glyphIndex, GlyphID previousGlyphIndex, FaceID faceId, const Font& font, u16vec2 dpi, bool sdf);
+		Glyph& RetrieveGlyph(GlyphID glyphIndex, FaceID faceId, const Font& font, u16vec2 dpi);
+
+		// Metrics of the glyph at the font's size as RetrieveGlyph and ScaleToFontSize give them, except for the bearing
+		// and size, which are of the glyph's control box instead of its bitmap. The glyph is not rasterized.
+		Glyph::Metrics GetMetrics(GlyphID glyphIndex, FaceID faceId, const Font& font, u16vec2 dpi);
+
+		// Kerning of the pair in 26.6 at the font's size, to be added to the advance of the left glyph
+		int32_t GetKerning(FaceID faceId, GlyphID left, GlyphID right, const Font& font, u16vec2 dpi);
+
+		// Stashes the requested glyphs that are not stashed yet, so that RetrieveGlyph finds them. They are loaded on the
+		// calling thread, rasterized concurrently one glyph per task and uploaded on the calling thread in the order of
+		// the requests. Bitmap glyphs are left to RetrieveGlyph. The glyphs that take room in the atlas are counted in
+		// `stats`, if given. Returns false if it stopped at a glyph because the atlas is full, which only happens while
+		// prewarming.
+		bool PrefetchGlyphs(const GlyphRequest* requests, int count, const Font& font, u16vec2 dpi, PrewarmStats* stats = nullptr);
+
+		// Stashes the glyphs of the characters that are not stashed yet, in the faces that have them, see PrefetchGlyphs.
+		// Stops once the atlas is full rather than evicting bands used in the frame. Fills all of `stats` but the time.
+		void Prewarm(const uint32_t* codes, int count, const Font& font, u16vec2 dpi, PrewarmStats& stats);
+
+		// Glyphs retrieved with a reference size have the metrics of that size, this converts a copy of them to the font's size
+		void ScaleToFontSize(Glyph& glyph, const Font& font, u16vec2 dpi) const;
+
+		// Size in pixels of the em at which all SDF and MSDF glyphs are rasterized, 0 rasterizes them for each font size and dpi
+		void SetSDFReferenceSize(uint16_t size);
+
+		void SetRasterMode(RasterMode::Enum mode);
+
+		RasterMode::Enum GetRasterMode() const { return m_rasterMode; }
+
+		void SetSDFGenerator(SDFGenerator::Enum generator) { m_sdfGenerator = generator; }
+
+		// Purges, the glyphs are packed into the atlas from scratch with the new packer
+		void SetAtlasPacker(AtlasPacker::Enum packer);
+
+		// Limits the number of atlas pages, and their memory if maxBytes is not 0. Purges the stash. Returns the limit in
+		// effect, which is also capped by the 64 bands a string can refer to.
+		int SetAtlasPages(int maxPages, size_t maxBytes);
+
+		AtlasStats GetAtlasStats() const;
+
+		// Writes the glyphs, the packers of the bands and the pixels of the atlas to a file. Glyphs of faces that are not
+		// in SFNT fonts are left out. False if the file cannot be written or there is no copy of the atlas to save.
+		bool SaveAtlas(const char* path);
+
+		// Replaces the stash with the one saved to the file. False, with the stash unchanged, if the file was saved by
+		// another version, with other raster settings or atlas size, for fonts that are not loaded, or if it is damaged.
+		bool LoadAtlas(const char* path);
+
+		// Bands of the glyphs, stamped with the evictions before they were retrieved
+		AtlasUse GetAtlasUse(const GlyphString& glyphs, uint32_t stamp) const;
+
+		uint32_t GetEvictionStamp() const { return m_evictions; }
+
+		// False if one of the bands was evicted since the glyphs were stashed
+		bool IsResident(const AtlasUse& use) const;
+
+		// Marks the bands as used in the current frame, they are the last to be evicted
+		void Touch(const AtlasUse& use);
+
+		void NextFrame() { ++m_frame; }
+
+		// Uploads the glyphs stashed since the last call, in as few regions as possible
+		void FlushUploads();
+
+		// Compaction frees bands that are mostly taken by glyphs that are no longer drawn. The glyphs drawn in the frame
+		// are live, one band per step the live glyphs of the band with the least of them are moved into the room left in
+		// the other bands, tallest glyph first and fullest band first, and the rest are dropped. Strings using the band
+		// are formatted again. It stops once no band is at most half live or the live glyphs do not fit elsewhere.
+		void StartCompaction();
+
+		// Call with the vertices of the frame once they are rendered
+		void StepCompaction(const Vertex* vertices, int vertexCount);
 
-		bool CheckIfOverflowedAndResetFlag() { bool tmp = m_was_overflowed;  m_was_overflowed = false; return tmp;}
 	private:
-		typedef uint32_t GlyphHash;
-		typedef std::map<GlyphHash, Glyph> GlyphMap;
+		// Glyph of PrefetchGlyphs, with a copy of its outline and the memory its bitmap is rasterized to
+		struct RasterTask;
+
+		struct AtlasBand;
+
+		GlyphKey GetGlyphKey(GlyphID glyphIndex, FaceID faceId, const Font& font, u16vec2 dpi) const;
+
+		// Loads the glyph into the slot of its face at the font's size and sets the metrics of `glyph`. Returns nullptr on failure.
+		FT_Face LoadGlyph(GlyphID glyphIndex, FaceID faceId, const Font& font, u16vec2 dpi, Glyph& glyph);
+
+		// Sets the face to the size SDF glyphs are rasterized at and the metrics of `glyph` at that size, from the cached
+		// outline. Returns the face.
+		FT_Face SetOutlineMetrics(const GlyphOutline& outline, FaceID faceId, const Font& font, u16vec2 dpi, Glyph& glyph);
+
+		struct StashResult
+		{
+			enum Enum : uint8_t
+			{
+				Stashed,
+				Failed,
+				AtlasFull
+			};
+		};
+
+		// Loads the bitmap glyph, renders it and stashes it into m_glyph. Failed if the glyph could not be loaded.
+		StashResult::Enum StashBitmapGlyph(GlyphID glyphIndex, FaceID faceId, const Font& font, u16vec2 dpi);
 
-		void Stash(Glyph& glyph, FT_BitmapGlyph bitmapGlyph, FT_BitmapGlyph outlineBitmapGlyph, UserData userdata);
+		// Returns false if the atlas is full while prewarming, the glyph is not stashed then
+		bool Stash(Glyph& glyph, FT_BitmapGlyph bitmapGlyph, FT_BitmapGlyph outlineBitmapGlyph, UserData userdata);
+
+		void CountPrewarmed(const Glyph& glyph, PrewarmStats& stats) const;
 		
-		void ResizeBitmap(uint16_t newSize);
+		// Staging image for an RG8 bitmap of the size. The buffer only grows, so that stashing does not allocate once it
+		// fits the largest glyph. Its content is left from the previous glyph unless `clear` is set.
+		Image GetStagingImage(ivec2 size, bool clear);
+
+		float GetOccupancy() const;
+
+		// Purges the stash if the format changes
+		void SetAtlasFormat(Image::DataType format);
+
+		// Recreates the bands, with one page
+		void CreateBands(AtlasPacker::Enum packer);
+
+		void AddPage();
+
+		// page limit for atlases of the format
+		int GetMaxPages(Image::DataType format) const;
 
-		GlyphMap m_glyphs;
+		// Band the glyph's bitmap is in, -1 if it has none
+		int GetBand(const Glyph& glyph) const;
+
+		void TouchGlyph(const Glyph& glyph);
+
+		enum
+		{
+			k_atlasFull = -2
+		};
+
+		// Finds room for a rectangle, evicting the least recently used band when the atlas is full. Returns the band, -1
+		// if the rectangle is larger than a band or k_atlasFull if prewarming and only bands used in the frame are left.
+		int Place(ivec2 size, ivec2& position);
+
+		void EvictBand(int band);
+
+		// Empties the band, the strings using it are no longer resident. Its part of the atlas is left as it is.
+		void ResetBand(int band);
+
+		// Clears a part of the atlas, in the copy of it or directly in the texture
+		void ClearAtlas(int page, ivec2 pos, ivec2 size);
+
+		// True if the glyph was drawn in the frame compaction steps in
+		bool IsLive(const Glyph& glyph) const;
+
+		// Moves the live glyphs of the band into the other bands and empties it. False if they do not all fit, then
+		// nothing is moved.
+		bool MoveBand(int band);
+
+		// Copies the image to the CPU copy of the atlas, or directly to the texture if the backend takes no regions
+		void UpdateAtlas(int band, Image image, u16vec2 pos);
+
+		// Adds the rectangle to the dirty ones, merged with those that waste little when joined
+		void MarkDirty(int page, ivec2 pos, ivec2 size);
+
+		GlyphTable m_glyphs;
 		
 		uint8_t* m_bitmap;
-		uint16_t m_bitmapSize;
+		size_t m_bitmapSize;
+		std::vector<RasterTask> m_rasterTasks;
 		FaceCollection* m_fc;
+		OutlineCache m_outlineCache;
+		KerningCache m_kerning;
+		GlyphMetricsCache m_metrics;
 		ivec2 m_stashTextureSize;
-		uint16_t m_maxHeight;
+		uint16_t m_sdfReferenceSize;
+		RasterMode::Enum m_rasterMode;
+		SDFGenerator::Enum m_sdfGenerator;
 		int m_spacing;
-		u16vec2 m_currentPos;
+		// Part of an atlas page, with its own packer
+		struct AtlasBand
+		{
+			IAtlasPackerPtr packer;
+			uint64_t usedArea;
+			uint32_t lastUsed;
+			uint32_t evictedAt;
+			// the rectangles inserted into the packer in order, so that compaction can replay them
+			std::vector<ivec2> sizes;
+		};
+
+		// part of a page that changed since the last upload
+		struct DirtyRect
+		{
+			int page;
+			ivec2 min;
+			ivec2 max;
+		};
+
+		// bands of all pages, page after page
+		std::vector<AtlasBand> m_bands;
+		AtlasPacker::Enum m_packerType;
+		int m_bandsPerPage;
+		int m_bandHeight;
+		int m_maxPages;
+		size_t m_maxPageBytes;
+		uint32_t m_frame;
+		uint32_t m_evictions;
+		AtlasStats m_stats;
+		Image::DataType m_atlasFormat;
+		std::vector<Image> m_shadowPages;
+		std::vector<DirtyRect> m_dirtyRects;
+		std::vector<TextureRegion> m_regions;
+		bool m_uploadPerGlyph;
+		bool m_compacting;
+		// Place does not evict bands used in the frame
+		bool m_prewarming;
+		// bands that did not fit in the others
+		uint64_t m_compactDone;
+		// the packers the bands are rebuilt in, swapped with theirs once the glyphs fit
+		std::vector<IAtlasPackerPtr> m_compactPackers;
+		std::vector<bool> m_compactReplayed;
+		std::vector<int> m_compactTargets;
+		// atlas positions of the glyphs drawn in the frame, sorted, and the area of those glyphs in each band
+		std::vector<uint64_t> m_live;
+		std::vector<uint64_t> m_liveArea;
+		std::vector<Glyph*> m_compactGlyphs;
+		std::vector<TextureCopy> m_copies;
+		std::vector<GlyphRequest> m_prewarmRequests;
+		std::vector<uint8_t> m_fileBuffer;
 		IRenderAPIPtr m_renderAPI;
 		FT_Stroker m_stroker;
 		FT_Library m_lib;
 		Glyph m_glyph;
 
-		bool m_was_overflowed;
 	};
 }
@@ -0,0 +1,111 @@
+#include "GlyphMetricsCache.h"
+#include "FaceCollection.h"
+#include "OutlineCache.h"
+
+#include <freetype.h>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace Scriber;
+
+enum
+{
+	k_initialCapacity = 512
+};
+
+GlyphMetricsCache::GlyphMetricsCache(FaceCollection* fc, OutlineCache* outlines)
+	: m_entries(k_initialCapacity)
+	, m_fc(fc)
+	, m_outlines(outlines)
+{
+}
+
+const Glyph::Metrics* GlyphMetricsCache::Get(FaceID faceId, GlyphID glyphIndex, uint16_t height, u16vec2 dpi, bool hinted)
+{
+	Key key;
+	memset(&key, 0, sizeof(Key));
+	key.glyphIndex = glyphIndex;
+	key.faceId = faceId;
+	key.height = height;
+	key.dpi = dpi;
+	key.hinted = hinted;
+
+	const Entry* entry = m_entries.Find(key);
+	if (entry == nullptr)
+	{
+		Entry loaded;
+		memset(&loaded, 0, sizeof(Entry));
+		loaded.loaded = Load(key, loaded.metrics);
+		entry = &m_entries.Insert(key, loaded);
+	}
+	return entry->loaded ? &entry->metrics : nullptr;
+}
+
+// Bearing and size of a box in 26.6, grown to whole pixels
+static void SetBox(FT_Pos xMin, FT_Pos yMin, FT_Pos xMax, FT_Pos yMax, Glyph::Metrics& metrics)
+{
+	xMin = xMin & -64;
+	yMin = yMin & -64;
+	xMax = (xMax + 63) & -64;
+	yMax = (yMax + 63) & -64;
+	metrics.horizontalBearing = i16vec2(xMin / 64, yMax / 64);
+	metrics.glyphSize = u16vec2((xMax - xMin) / 64, (yMax - yMin) / 64);
+}
+
+bool GlyphMetricsCache::Load(const Key& key, Glyph::Metrics& metrics)
+{
+	FT_Face face = m_fc->GetFace(key.faceId);
+	if (key.hinted)
+	{
+		// the same load as GlyphBitmapStash::LoadGlyph, without the rendering
+		FT_Set_Char_Size(face, 0, F26p6(key.height).v, key.dpi.x, key.dpi.y);
+		if (FT_Load_Glyph(face, key.glyphIndex, FT_LOAD_NO_BITMAP) != FT_Err_Ok)
+		{
+			return false;
+		}
+		const FT_Glyph_Metrics& glyph = face->glyph->metrics;
+		metrics.horiAdvance.v = glyph.horiAdvance;
+		metrics.ascender.v = face->size->metrics.ascender;
+		metrics.descender.v = face->size->metrics.descender;
+		SetBox(glyph.horiBearingX, glyph.horiBearingY - glyph.height, glyph.horiBearingX + glyph.width, glyph.horiBearingY, metrics);
+		return true;
+	}
+
+	const GlyphOutline& outline = m_outlines->Get(key.faceId, key.glyphIndex);
+	if (!outline.loaded)
+	{
+		return false;
+	}
+
+	// the same scaling as GlyphBitmapStash::SetOutlineMetrics
+	bool reference = key.dpi == u16vec2(0);
+	if (reference)
+	{
+		FT_Set_Char_Size(face, 0, F26p6(key.height).v, 72, 72);
+	}
+	else
+	{
+		FT_Set_Char_Size(face, 0, F26p6(key.height).v, key.dpi.x, key.dpi.y);
+	}
+	FT_Fixed x_scale = face->size->metrics.x_scale;
+	FT_Fixed y_scale = face->size->metrics.y_scale;
+
+	FT_Pos advance = FT_MulFix(outline.advance, x_scale);
+	metrics.horiAdvance.v = reference ? advance : (advance + 32) & -64;
+	metrics.ascender.v = face->size->metrics.ascender;
+	metrics.descender.v = face->size->metrics.descender;
+
+	if (!outline.points.empty())
+	{
+		ivec2 min = outline.points[0];
+		ivec2 max = outline.points[0];
+		for (const ivec2& point : outline.points)
+		{
+			min = ivec2(std::min(min.x, point.x), std::min(min.y, point.y));
+			max = ivec2(std::max(max.x, point.x), std::max(max.y, point.y));
+		}
+		SetBox(FT_MulFix(min.x, x_scale), FT_MulFix(min.y, y_scale), FT_MulFix(max.x, x_scale), FT_MulFix(max.y, y_scale), metrics);
+	}
+	return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "ForwardDecl.h"
+#include "Utils.h"
+#include "Glyph.h"
+#include "OpenHashTable.h"
+
+namespace Scriber
+{
+	class FaceCollection;
+	class OutlineCache;
+
+	// Metrics of glyphs per face and size, loaded without rendering them, for text that is measured but not drawn
+	class GlyphMetricsCache
+	{
+	public:
+		GlyphMetricsCache(const GlyphMetricsCache& other) = delete;
+		GlyphMetricsCache& operator=(const GlyphMetricsCache&) = delete;
+
+		GlyphMetricsCache(FaceCollection* fc, OutlineCache* outlines);
+
+		// Hinted metrics come from FT_Load_Glyph at the size, as bitmap glyphs have them. The others are scaled from the
+		// cached outline, as distance field glyphs have them, zero dpi gives them unrounded at `height` pixels. The
+		// bearing and size are those of the control box, in whole pixels. nullptr if the glyph could not be loaded.
+		const Glyph::Metrics* Get(FaceID faceId, GlyphID glyphIndex, uint16_t height, u16vec2 dpi, bool hinted);
+
+	private:
+		struct Key
+		{
+			GlyphID glyphIndex;
+			FaceID faceId;
+			uint16_t height;
+			u16vec2 dpi;
+			bool hinted;
+		};
+
+		struct Entry
+		{
+			bool loaded;
+			Glyph::Metrics metrics;
+		};
+
+		bool Load(const Key& key, Glyph::Metrics& metrics);
+
+		OpenHashTable<Key, Entry> m_entries;
+		FaceCollection* m_fc;
+		OutlineCache* m_outlines;
+	};
+}
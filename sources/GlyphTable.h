@@ -0,0 +1,22 @@
+#pragma once
+#include "ForwardDecl.h"
+#include "Attributes.h"
+#include "Glyph.h"
+#include "OpenHashTable.h"
+
+namespace Scriber
+{
+	// Everything a stashed bitmap depends on. Padding is zeroed, so that keys can be hashed and compared as memory.
+	struct GlyphKey
+	{
+		GlyphID glyphIndex;
+		FaceID faceId;
+		uint16_t height;
+		FontStyle::Enum style;
+		uint16_t stroke;
+		u16vec2 dpi;
+	};
+
+	// Stashed glyphs, keyed by the full GlyphKey
+	typedef OpenHashTable<GlyphKey, Glyph> GlyphTable;
+}
@@ -48,10 +48,6 @@ Image Image::FromUnalignedData(const void* data, DataType d, ivec2 size, uint8_t
 	return im;
 }
 
-static void NoDelete(const void*)
-{
-}
-
 Image Image::FromMemory(const void* data, DataType d, ivec2 size, uint8_t alignment)
 {
 	Image im;
@@ -61,7 +57,8 @@ Image Image::FromMemory(const void* data, DataType d, ivec2 size, uint8_t alignm
 	im.row_stride = MemoryAlign(im.GetRowSize(), im.alignment);
 	im.row_size = im.GetRowSize();
 	im.data_size = im.row_stride * (size_t)im.size.y;
-	im._ptr.reset((uint8_t*)data, NoDelete);
+	// aliases an empty owner, the image does not own the memory and no control block is allocated
+	im._ptr = std::shared_ptr<uint8_t>(std::shared_ptr<uint8_t>(), (uint8_t*)data);
 	return im;
 }
 
@@ -0,0 +1,60 @@
+#include "KerningCache.h"
+#include "FaceCollection.h"
+
+#include <freetype.h>
+
+#include <cstring>
+
+using namespace Scriber;
+
+enum
+{
+	k_initialCapacity = 1024
+};
+
+KerningCache::KerningCache(FaceCollection* fc): m_kerning(k_initialCapacity), m_fc(fc)
+{
+}
+
+int32_t KerningCache::Get(FaceID faceId, GlyphID left, GlyphID right, uint16_t height, u16vec2 dpi)
+{
+	if (left == 0 || right == 0)
+	{
+		return 0;
+	}
+	FT_Face face = m_fc->GetFace(faceId);
+	if (!FT_HAS_KERNING(face))
+	{
+		return 0;
+	}
+
+	Key key;
+	memset(&key, 0, sizeof(Key));
+	key.left = left;
+	key.right = right;
+	key.faceId = faceId;
+	key.height = height;
+	key.dpi = dpi;
+
+	const int32_t* cached = m_kerning.Find(key);
+	if (cached != nullptr)
+	{
+		return *cached;
+	}
+
+	bool unfitted = dpi == u16vec2(0);
+	if (unfitted)
+	{
+		FT_Set_Char_Size(face, 0, F26p6(height).v, 72, 72);
+	}
+	else
+	{
+		FT_Set_Char_Size(face, 0, F26p6(height).v, dpi.x, dpi.y);
+	}
+	FT_Vector delta;
+	if (FT_Get_Kerning(face, left, right, unfitted ? FT_KERNING_UNFITTED : FT_KERNING_DEFAULT, &delta) != FT_Err_Ok)
+	{
+		delta.x = 0;
+	}
+	return m_kerning.Insert(key, (int32_t)delta.x);
+}
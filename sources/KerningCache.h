@@ -0,0 +1,37 @@
+#pragma once
+#include "ForwardDecl.h"
+#include "Utils.h"
+#include "OpenHashTable.h"
+
+namespace Scriber
+{
+	class FaceCollection;
+
+	// Kerning of glyph pairs per face and size, loaded from FreeType on first use. Open addressing, so that a lookup is a
+	// single probe in the common case.
+	class KerningCache
+	{
+	public:
+		KerningCache(const KerningCache& other) = delete;
+		KerningCache& operator=(const KerningCache&) = delete;
+
+		KerningCache(FaceCollection* fc);
+
+		// Horizontal kerning in 26.6, added to the advance of `left`. Zero dpi returns the unfitted kerning at `height`
+		// pixels, for glyphs that are scaled afterwards. Zero if the face has no kerning.
+		int32_t Get(FaceID faceId, GlyphID left, GlyphID right, uint16_t height, u16vec2 dpi);
+
+	private:
+		struct Key
+		{
+			GlyphID left;
+			GlyphID right;
+			FaceID faceId;
+			uint16_t height;
+			u16vec2 dpi;
+		};
+
+		OpenHashTable<Key, int32_t> m_kerning;
+		FaceCollection* m_fc;
+	};
+}
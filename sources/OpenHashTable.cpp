@@ -0,0 +1,10 @@
+#include "OpenHashTable.h"
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+uint32_t Scriber::HashMemory(const void* data, size_t size)
+{
+	uint32_t hash = XXH32(data, size, 0);
+	return hash != 0 ? hash : 1;
+}
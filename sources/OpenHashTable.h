@@ -0,0 +1,159 @@
+#pragma once
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+
+namespace Scriber
+{
+	// XXH32 of the memory, never 0
+	uint32_t HashMemory(const void* data, size_t size);
+
+	// For keys whose padding is zeroed, so that they can be hashed and compared as memory
+	template<typename Key>
+	struct MemoryHash
+	{
+		uint32_t operator()(const Key& key) const { return HashMemory(&key, sizeof(Key)); }
+	};
+
+	// Open addressing hash table with linear probing. Values are stored in the slots, so a lookup touches one or two
+	// cache lines and inserting does not allocate until the table grows. Keys are compared as memory, the hash must not
+	// be 0, which marks empty slots.
+	template<typename Key, typename Value, typename Hash = MemoryHash<Key> >
+	class OpenHashTable
+	{
+	public:
+		// the capacity is a power of 2
+		explicit OpenHashTable(size_t capacity = 256): m_slots(capacity, Slot()), m_size(0)
+		{
+		}
+
+		// nullptr if the key is not in the table
+		Value* Find(const Key& key);
+
+		// Replaces the value if the key is already in the table. The reference is valid until the next insertion.
+		Value& Insert(const Key& key, const Value& value);
+
+		template<typename Predicate>
+		void EraseIf(Predicate predicate);
+
+		// Calls function(key, value) for each value
+		template<typename Function>
+		void ForEach(Function function);
+
+		void Clear();
+
+		size_t Size() const { return m_size; }
+
+	private:
+		struct Slot
+		{
+			uint32_t hash; // 0 for empty slots
+			Key key;
+			Value value;
+		};
+
+		Slot& Probe(const Key& key, uint32_t hash);
+
+		void Rehash(size_t capacity);
+
+		std::vector<Slot> m_slots;
+		std::vector<Slot> m_scratch;
+		size_t m_size;
+	};
+
+	template<typename Key, typename Value, typename Hash>
+	inline typename OpenHashTable<Key, Value, Hash>::Slot& OpenHashTable<Key, Value, Hash>::Probe(const Key& key, uint32_t hash)
+	{
+		size_t mask = m_slots.size() - 1;
+		for (size_t i = hash & mask;; i = (i + 1) & mask)
+		{
+			Slot& slot = m_slots[i];
+			if (slot.hash == 0 || (slot.hash == hash && memcmp(&slot.key, &key, sizeof(Key)) == 0))
+			{
+				return slot;
+			}
+		}
+	}
+
+	template<typename Key, typename Value, typename Hash>
+	inline Value* OpenHashTable<Key, Value, Hash>::Find(const Key& key)
+	{
+		Slot& slot = Probe(key, Hash()(key));
+		return slot.hash != 0 ? &slot.value : nullptr;
+	}
+
+	template<typename Key, typename Value, typename Hash>
+	inline Value& OpenHashTable<Key, Value, Hash>::Insert(const Key& key, const Value& value)
+	{
+		// at most half full, probe sequences stay short
+		if ((m_size + 1) * 2 > m_slots.size())
+		{
+			Rehash(m_slots.size() * 2);
+		}
+		uint32_t hash = Hash()(key);
+		Slot& slot = Probe(key, hash);
+		if (slot.hash == 0)
+		{
+			slot.hash = hash;
+			slot.key = key;
+			++m_size;
+		}
+		slot.value = value;
+		return slot.value;
+	}
+
+	template<typename Key, typename Value, typename Hash>
+	template<typename Predicate>
+	inline void OpenHashTable<Key, Value, Hash>::EraseIf(Predicate predicate)
+	{
+		// the kept values are inserted again, so that no probe sequence is broken by the erased ones
+		m_scratch.swap(m_slots);
+		m_slots.assign(m_scratch.size(), Slot());
+		m_size = 0;
+		for (const Slot& slot : m_scratch)
+		{
+			if (slot.hash != 0 && !predicate(slot.value))
+			{
+				Probe(slot.key, slot.hash) = slot;
+				++m_size;
+			}
+		}
+	}
+
+	template<typename Key, typename Value, typename Hash>
+	template<typename Function>
+	inline void OpenHashTable<Key, Value, Hash>::ForEach(Function function)
+	{
+		for (Slot& slot : m_slots)
+		{
+			if (slot.hash != 0)
+			{
+				function(static_cast<const Key&>(slot.key), slot.value);
+			}
+		}
+	}
+
+	template<typename Key, typename Value, typename Hash>
+	inline void OpenHashTable<Key, Value, Hash>::Clear()
+	{
+		for (Slot& slot : m_slots)
+		{
+			slot.hash = 0;
+		}
+		m_size = 0;
+	}
+
+	template<typename Key, typename Value, typename Hash>
+	inline void OpenHashTable<Key, Value, Hash>::Rehash(size_t capacity)
+	{
+		m_scratch.swap(m_slots);
+		m_slots.assign(capacity, Slot());
+		for (const Slot& slot : m_scratch)
+		{
+			if (slot.hash != 0)
+			{
+				Probe(slot.key, slot.hash) = slot;
+			}
+		}
+	}
+}
@@ -0,0 +1,44 @@
+#include "OutlineCache.h"
+#include "FaceCollection.h"
+
+#include <freetype.h>
+
+using namespace Scriber;
+
+
+OutlineCache::OutlineCache(FaceCollection* fc): m_fc(fc)
+{
+}
+
+const GlyphOutline& OutlineCache::Get(FaceID faceId, GlyphID glyphIndex)
+{
+	uint64_t key = uint64_t(faceId) << 32 | glyphIndex;
+
+	auto lb = m_outlines.lower_bound(key);
+	if (lb != m_outlines.end() && key == lb->first)
+	{
+		return lb->second;
+	}
+
+	GlyphOutline& outline = m_outlines.insert(lb, std::make_pair(key, GlyphOutline()))->second;
+
+	FT_Face face = m_fc->GetFace(faceId);
+	outline.loaded = FT_Load_Glyph(face, glyphIndex, FT_LOAD_NO_SCALE) == FT_Err_Ok;
+	outline.isOutline = outline.loaded && face->glyph->format == FT_GLYPH_FORMAT_OUTLINE;
+	outline.advance = outline.loaded ? (int32_t)face->glyph->metrics.horiAdvance : 0;
+	outline.flags = 0;
+
+	if (outline.isOutline)
+	{
+		const FT_Outline& source = face->glyph->outline;
+		outline.flags = source.flags;
+		outline.points.resize(source.n_points);
+		for (int i = 0; i < source.n_points; ++i)
+		{
+			outline.points[i] = ivec2((int)source.points[i].x, (int)source.points[i].y);
+		}
+		outline.tags.assign(source.tags, source.tags + source.n_points);
+		outline.contours.assign(source.contours, source.contours + source.n_contours);
+	}
+	return outline;
+}
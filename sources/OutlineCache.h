@@ -0,0 +1,40 @@
+#pragma once
+#include "ForwardDecl.h"
+#include "Utils.h"
+#include <map>
+#include <vector>
+
+namespace Scriber
+{
+	class FaceCollection;
+
+	// Outline of a glyph in font units, the same for all sizes of the glyph
+	struct GlyphOutline
+	{
+		bool loaded;     // false if FreeType could not load the glyph
+		bool isOutline;  // false for glyph formats without an outline
+		int32_t advance; // horizontal advance in font units
+		int flags;       // FT_Outline flags
+		std::vector<ivec2> points;
+		std::vector<char> tags;
+		std::vector<short> contours;
+	};
+
+	// Outlines per face and glyph, loaded with FT_LOAD_NO_SCALE once, so that rasterizing a glyph at another size or
+	// dpi does not go through FT_Load_Glyph again.
+	class OutlineCache
+	{
+	public:
+		OutlineCache(const OutlineCache& other) = delete;
+		OutlineCache& operator=(const OutlineCache&) = delete;
+
+		OutlineCache(FaceCollection* fc);
+
+		// Faces are never unloaded, so outlines are kept for the lifetime of the cache and the reference stays valid
+		const GlyphOutline& Get(FaceID faceId, GlyphID glyphIndex);
+
+	private:
+		std::map<uint64_t, GlyphOutline> m_outlines;
+		FaceCollection* m_fc;
+	};
+}
@@ -6,20 +6,19 @@
 #include "StringFormater.h"
 #include "TextRenderer.h"
 #include "IRenderAPI.h"
+#include "sdfKernels.h"
+#include "FileIO.h"
 
 #include <freetype.h>
+#include <utf8.h>
 
 #include <vector>
 #include <map>
+#include <chrono>
+#include <cstring>
 
 using namespace Scriber;
 
-static fopenfunc s_open;
-static fclosefunc s_close;
-static freadfunc s_read;
-static fseekfunc s_seek;
-static ftellfunc s_tell;
-
 namespace Scriber
 {
 	struct FTLib
@@ -49,6 +48,7 @@ namespace Scriber
 				, layoutEngine(&faceCollection)
 				, renderAPI(new SoftwareRenderAPI)
 				, glyphBitmapStash(lib.lib, &faceCollection, renderAPI)
+				, stringStash(&glyphBitmapStash)
 				, stringFormater(&layoutEngine, &glyphBitmapStash)
 				, textRenderer(renderAPI)
 				, m_dpi(72)
@@ -62,6 +62,7 @@ namespace Scriber
 				, layoutEngine(&faceCollection)
 				, renderAPI(std::move(renderer))
 				, glyphBitmapStash(lib.lib, &faceCollection, renderAPI)
+				, stringStash(&glyphBitmapStash)
 				, stringFormater(&layoutEngine, &glyphBitmapStash)
 				, textRenderer(renderAPI)
 				, m_dpi(72)
@@ -91,6 +92,7 @@ namespace Scriber
 			*/
 
 			u16vec2 m_dpi;
+			utf32string m_measuredText;
 		};
 	}
 }
@@ -118,11 +120,7 @@ void Driver::AndFontToTypeface(TypefaceID tf, const char* filename, FontStyle::E
 
 void Driver::ResetIOFunctions()
 {
-	s_open = nullptr;
-	s_close = nullptr;
-	s_read = nullptr;
-	s_seek = nullptr;
-	s_tell = nullptr;
+	detail::io::SetFunctions(nullptr, nullptr, nullptr, nullptr, nullptr, nullptr);
 	ft_set_file_callback(
 	[](const char* filename, const char* mode)
 	{
@@ -146,33 +144,29 @@ void Driver::ResetIOFunctions()
 	});
 }
 
-void Driver::SetCustomIOFunctions(fopenfunc open, fclosefunc close, freadfunc read, fseekfunc seek, ftellfunc tell)
+void Driver::SetCustomIOFunctions(fopenfunc open, fclosefunc close, freadfunc read, fseekfunc seek, ftellfunc tell, fwritefunc write)
 {
-	s_open = open;
-	s_close = close;
-	s_read = read;
-	s_seek = seek;
-	s_tell = tell;
+	detail::io::SetFunctions(open, close, read, seek, tell, write);
 	ft_set_file_callback(
 	[](const char* filename, const char* mode)
 	{
-		return (FILE*)(s_open(filename, mode));
+		return (FILE*)(detail::io::Open(filename, mode));
 	},
 	[](FILE* userfile)
 	{
-		return s_close((UserFile*)userfile);
+		return detail::io::Close((UserFile*)userfile);
 	},
 	[](void* ptr, size_t size, size_t count, FILE* file)
 	{
-		return s_read(ptr, size, count, (UserFile*)file);
+		return detail::io::Read(ptr, size, count, (UserFile*)file);
 	},
 	[](FILE* file, long int offset, int origin)
 	{
-		return s_seek((UserFile*)file, offset, origin);
+		return detail::io::Seek((UserFile*)file, offset, origin);
 	},
 	[](FILE* file)
 	{
-		return s_tell((UserFile*)file);
+		return detail::io::Tell((UserFile*)file);
 	});
 }
 
@@ -183,13 +177,29 @@ void Driver::SetDPI(uint16_t x, uint16_t y)
 
 void Driver::DrawLabel(const char* text, int position_x, int position_y, const Font& font, Align::Enum alignment, float true_hight)
 {
-	const GlyphString* glyphString = &m_impl->stringStash.GetGlyphString(text, m_impl->m_dpi, font);
-	if (m_impl->glyphBitmapStash.CheckIfOverflowedAndResetFlag())
-	{
-		m_impl->stringStash.Purge();
-		glyphString = &m_impl->stringStash.GetGlyphString(text, m_impl->m_dpi, font);
-	}
-	m_impl->textRenderer.SumbitGlyphString(*glyphString, ivec2(position_x, position_y), m_impl->m_dpi, font, alignment, true_hight);
+	const GlyphString& glyphString = m_impl->stringStash.GetGlyphString(text, m_impl->m_dpi, font);
+	bool distanceField = m_impl->glyphBitmapStash.GetRasterMode() != RasterMode::Bitmap;
+	m_impl->textRenderer.SumbitGlyphString(glyphString, ivec2(position_x, position_y), m_impl->m_dpi, font, alignment, true_hight, distanceField);
+}
+
+void Driver::MeasureLabel(const char* text, const Font& font, float* width, float* ascent, float* descent)
+{
+	u16vec2 dpi = m_impl->m_dpi;
+	m_impl->m_measuredText.clear();
+	utf8::utf8to32(text, text + strlen(text), std::back_inserter(m_impl->m_measuredText));
+
+	int32_t w = 0;
+	int32_t a = 0;
+	int32_t d = 0;
+	m_impl->stringFormater.Measure(m_impl->m_measuredText, font, dpi, w, a, d);
+
+	// 26.6 pixels to the units of the label position, see toPixel
+	if (width != nullptr)
+		*width = w * 72.0f / (64.0f * dpi.x);
+	if (ascent != nullptr)
+		*ascent = a * 72.0f / (64.0f * dpi.y);
+	if (descent != nullptr)
+		*descent = d * 72.0f / (64.0f * dpi.y);
 }
 
 void Driver::CleanStash()
@@ -198,9 +208,56 @@ void Driver::CleanStash()
 	m_impl->glyphBitmapStash.Purge();
 }
 
+static PrewarmStats Prewarm(detail::DriverImpl* impl, const std::vector<uint32_t>& codes, const Font& font)
+{
+	auto start = std::chrono::steady_clock::now();
+	PrewarmStats stats;
+	impl->glyphBitmapStash.Prewarm(codes.data(), (int)codes.size(), font, impl->m_dpi, stats);
+	stats.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+PrewarmStats Driver::Prewarm(const char* utf8Chars, const Font& font)
+{
+	std::vector<uint32_t> codes;
+	utf8::utf8to32(utf8Chars, utf8Chars + strlen(utf8Chars), std::back_inserter(codes));
+	return ::Prewarm(m_impl.get(), codes, font);
+}
+
+PrewarmStats Driver::Prewarm(uint32_t first, uint32_t last, const Font& font)
+{
+	std::vector<uint32_t> codes;
+	for (uint64_t code = first; code <= last; ++code)
+	{
+		codes.push_back(uint32_t(code));
+	}
+	return ::Prewarm(m_impl.get(), codes, font);
+}
+
+bool Driver::SaveAtlasCache(const char* path)
+{
+	return m_impl->glyphBitmapStash.SaveAtlas(path);
+}
+
+bool Driver::LoadAtlasCache(const char* path)
+{
+	if (!m_impl->glyphBitmapStash.LoadAtlas(path))
+	{
+		return false;
+	}
+	m_impl->stringStash.Purge();
+	return true;
+}
+
 void Driver::Render()
 {
+	m_impl->glyphBitmapStash.FlushUploads();
 	m_impl->textRenderer.CommitStashed();
+	// the glyphs drawn in this frame are submitted, they can move now
+	int vertexCount = 0;
+	const Vertex* vertices = m_impl->textRenderer.GetCommittedVertices(vertexCount);
+	m_impl->glyphBitmapStash.StepCompaction(vertices, vertexCount);
+	m_impl->glyphBitmapStash.NextFrame();
 	/*
 	m_glyphCache->GetTexture()->Bind(0);
 	m_fontRenderer->DrawCache(m_textShader);
@@ -213,6 +270,56 @@ void Driver::SetBackend(IRenderAPIPtr renderAPI)
 	m_impl.reset(new detail::DriverImpl(std::move(renderAPI)));
 }
 
+void Driver::SetSDFReferenceSize(uint16_t size)
+{
+	m_impl->stringStash.Purge();
+	m_impl->glyphBitmapStash.SetSDFReferenceSize(size);
+}
+
+void Driver::SetRasterMode(RasterMode::Enum mode)
+{
+	m_impl->stringStash.Purge();
+	m_impl->glyphBitmapStash.SetRasterMode(mode);
+}
+
+void Driver::SetAtlasPacker(AtlasPacker::Enum packer)
+{
+	m_impl->stringStash.Purge();
+	m_impl->glyphBitmapStash.SetAtlasPacker(packer);
+}
+
+int Driver::SetAtlasPages(int maxPages, size_t maxBytes)
+{
+	m_impl->stringStash.Purge();
+	return m_impl->glyphBitmapStash.SetAtlasPages(maxPages, maxBytes);
+}
+
+void Driver::CompactAtlas()
+{
+	m_impl->glyphBitmapStash.StartCompaction();
+}
+
+AtlasStats Driver::GetAtlasStats() const
+{
+	return m_impl->glyphBitmapStash.GetAtlasStats();
+}
+
+void Driver::SetSDFGenerator(SDFGenerator::Enum generator)
+{
+	m_impl->glyphBitmapStash.SetSDFGenerator(generator);
+}
+
+SIMDLevel::Enum Driver::SetSIMDLevel(SIMDLevel::Enum level)
+{
+	detail::SetSDFSIMDLevel(level);
+	return detail::GetSDFSIMDLevel();
+}
+
+SIMDLevel::Enum Driver::GetSIMDLevel()
+{
+	return detail::GetSDFSIMDLevel();
+}
+
 /*
 void TextEngine::Draw(const std::string& string, const glm::ivec4& color, int fontStyleId, const glm::vec2& position, Alignment alignment)
 {
@@ -1,7 +1,15 @@
 #include "StringFormater.h"
 
+#include <algorithm>
+
 using namespace Scriber;
 
+// Rounds to the nearest integer, halves away from zero, so that negative values round the same way as positive ones
+static int DivideRounded(int value, int divisor)
+{
+	return value >= 0 ? (value + divisor / 2) / divisor : -((divisor / 2 - value) / divisor);
+}
+
 StringFormater::StringFormater(LayoutEngine* le, GlyphBitmapStash* gs)
 	: m_layout(le)
 	, m_glyphStash(gs)
@@ -12,21 +20,69 @@ void StringFormater::Format(utf32string& string, const Font& font, u16vec2 dpi,
 {
 	const LayoutDataString& layout = m_layout->Process(string, 0, string.size(), dpi, font);
 
-	uint16_t lastGlyph = 0;
+	// the glyphs that are not cached yet are rasterized together, see GlyphBitmapStash::PrefetchGlyphs
+	m_requests.clear();
+	for (auto it = layout.begin(); it != layout.end(); ++it)
+	{
+		m_requests.push_back({it->glyph, it->id});
+	}
+	m_glyphStash->PrefetchGlyphs(m_requests.data(), (int)m_requests.size(), font, dpi);
 
+	// a glyph is inserted once the next one is known, as the kerning of the pair moves the next one
+	Glyph previous;
+	bool hasPrevious = false;
 	for (auto it = layout.begin(); it != layout.end(); ++it)
 	{
-		Glyph glyph = m_glyphStash->RetrieveGlyph(it->glyph, lastGlyph, it->id, font, dpi, true);
-		
+		Glyph glyph = m_glyphStash->RetrieveGlyph(it->glyph, it->id, font, dpi);
+		m_glyphStash->ScaleToFontSize(glyph, font, dpi);
+
 		glyph.m_code = it->code;
 		glyph.m_color = font.color;
-		glyph.m_metrics.horizontalBearing.x += it->offset.x;
-		glyph.m_metrics.horizontalBearing.y += it->offset.y;
+		// the offsets are in pixels of the font's size, the bearing in pixels of the bitmap
+		glyph.m_metrics.horizontalBearing.x += DivideRounded(it->offset.x * 256, glyph.m_bitmapScale);
+		glyph.m_metrics.horizontalBearing.y += DivideRounded(it->offset.y * 256, glyph.m_bitmapScale);
 		if (it->advance.v != 0xFFFF)
 			glyph.m_metrics.horiAdvance.v = it->advance.v;
+		else if (hasPrevious && (it - 1)->id == it->id && (it - 1)->advance.v == 0xFFFF)
+			previous.m_metrics.horiAdvance.v += m_glyphStash->GetKerning(it->id, (it - 1)->glyph, it->glyph, font, dpi);
+
+		if (hasPrevious)
+			inserter = previous;
+		previous = glyph;
+		hasPrevious = true;
+	}
+	if (hasPrevious)
+		inserter = previous;
+}
+
+void StringFormater::Measure(utf32string& string, const Font& font, u16vec2 dpi, int32_t& width, int32_t& ascent, int32_t& descent)
+{
+	const LayoutDataString& layout = m_layout->Process(string, 0, string.size(), dpi, font);
+
+	int32_t lineHeight = toPixel(font.height * 64, dpi.y);
+	int32_t penX = 0;
+	int32_t penY = 0;
+	width = 0;
+	ascent = 0;
+	descent = 0;
+	for (auto it = layout.begin(); it != layout.end(); ++it)
+	{
+		if (it->code == '\n')
+		{
+			penX = 0;
+			penY += lineHeight;
+			continue;
+		}
 
-		inserter = glyph;
+		Glyph::Metrics metrics = m_glyphStash->GetMetrics(it->glyph, it->id, font, dpi);
+		int32_t advance = it->advance.v != 0xFFFF ? it->advance.v : metrics.horiAdvance.v;
+		// the kerning of the pair moves the next glyph, as in Format
+		if (it->advance.v == 0xFFFF && it + 1 != layout.end() && (it + 1)->id == it->id && (it + 1)->advance.v == 0xFFFF)
+			advance += m_glyphStash->GetKerning(it->id, it->glyph, (it + 1)->glyph, font, dpi);
 
-		lastGlyph = it->glyph;
+		ascent = std::max(metrics.ascender.v - penY, ascent);
+		descent = std::max(penY - metrics.descender.v, descent);
+		penX += advance;
+		width = std::max(penX, width);
 	}
 }
@@ -15,9 +15,14 @@ namespace Scriber
 
 		void Format(utf32string& string, const Font& font, u16vec2 dpi, GlyphStringInsert& inserter);
 
+		// Extents of the string as TextRenderer lays Format's glyphs out, in 26.6 pixels, without rasterizing them. The
+		// width of the widest line, the ascent above the pen position of the first line and the descent below it.
+		void Measure(utf32string& string, const Font& font, u16vec2 dpi, int32_t& width, int32_t& ascent, int32_t& descent);
+
 	private:
 		LayoutEngine* m_layout;
 		GlyphBitmapStash* m_glyphStash;
+		std::vector<GlyphRequest> m_requests;
 		uint16_t m_empty_characters_replacement;
 	};
 }
@@ -6,6 +6,10 @@
 
 using namespace Scriber;
 
+StringStash::StringStash(GlyphBitmapStash* gbs): m_gbs(gbs)
+{
+}
+
 const GlyphString& StringStash::GetGlyphString(const char* text, u16vec2 dpi, const Font& font)
 {
 	string_hash fontHash = XXH32(&font, sizeof(Font), 0);
@@ -16,22 +20,47 @@ const GlyphString& StringStash::GetGlyphString(const char* text, u16vec2 dpi, co
 	
 	if (lb != m_stringCache.end() && (hash == lb->first))
 	{
-		return lb->second;
+		Entry& entry = lb->second;
+		if (m_gbs->IsResident(entry.atlas))
+		{
+			m_gbs->Touch(entry.atlas);
+			return entry.glyphs;
+		}
+
+		// some of its glyphs were evicted from the atlas, only this string is formatted again
+		entry.atlas = Format(text, length, dpi, font);
+		entry.glyphs = m_glyphs;
 	}
 	else
 	{
+		AtlasUse atlas = Format(text, length, dpi, font);
+		Entry entry = {m_glyphs, atlas};
+		m_stringCache.insert(lb, StringCache::value_type(hash, std::move(entry)));
+	}
+
+	return m_glyphs;
+}
+
+AtlasUse StringStash::Format(const char* text, size_t length, u16vec2 dpi, const Font& font)
+{
+	// A band holding the first glyphs may be evicted to make room for the last ones, the string is then retrieved
+	// once more. The second time its glyphs are all in bands used in this frame, which are evicted last.
+	AtlasUse atlas;
+	for (int attempt = 0; attempt < 2; ++attempt)
+	{
+		uint32_t stamp = m_gbs->GetEvictionStamp();
 		m_glyphs.clear();
 		m_text_utf32.clear();
 		utf8::utf8to32(text, text + length, std::back_inserter(m_text_utf32));
-
 		auto inserter = std::back_inserter(m_glyphs);
-
 		m_stringProcessor(m_text_utf32, font, dpi, inserter);
-
-		m_stringCache.insert(lb, StringCache::value_type(hash, m_glyphs));
+		atlas = m_gbs->GetAtlasUse(m_glyphs, stamp);
+		if (m_gbs->IsResident(atlas))
+		{
+			break;
+		}
 	}
-
-	return m_glyphs;
+	return atlas;
 }
 
 void StringStash::AssignStringProcessor(const StringProcessor& processor)
@@ -1,6 +1,7 @@
 #pragma once
 #include "Scriber.h"
 #include "Glyph.h"
+#include "GlyphBitmapStash.h"
 
 #include <map>
 #include <functional>
@@ -12,6 +13,8 @@ namespace Scriber
 	class StringStash
 	{
 	public:
+		explicit StringStash(GlyphBitmapStash* gbs);
+
 		const GlyphString& GetGlyphString(const char* text, u16vec2 dpi, const Font& font);
 
 		void AssignStringProcessor(const StringProcessor& processor);
@@ -20,8 +23,16 @@ namespace Scriber
 
 	private:
 		typedef uint32_t string_hash;
-		typedef std::map<string_hash, GlyphString> StringCache;
+		struct Entry
+		{
+			GlyphString glyphs;
+			AtlasUse atlas;
+		};
+		typedef std::map<string_hash, Entry> StringCache;
+
+		AtlasUse Format(const char* text, size_t length, u16vec2 dpi, const Font& font);
 
+		GlyphBitmapStash* m_gbs;
 		StringProcessor m_stringProcessor;
 		StringCache     m_stringCache;
 		utf32string     m_text_utf32;
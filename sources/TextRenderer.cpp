@@ -2,6 +2,7 @@
 #include "Utils.h"
 
 #include <algorithm>
+#include <cstring>
 
 using namespace Scriber;
 
@@ -10,12 +11,23 @@ enum
 	k_initialBufferSize = 0x1000
 };
 
+// drop shadows go under the glyphs of all strings, whatever pages they are on
+enum
+{
+	k_shadowLayer,
+	k_glyphLayer,
+	k_layerCount
+};
+
 TextRenderer::TextRenderer(IRenderAPIPtr renderAPI)
 	: m_maxVertexBufferSize(0)
 	, m_vertexBuffer(nullptr)
+	, m_pageSortedBuffer(nullptr)
 	, m_indexBuffer(nullptr)
 	, m_vertexIterator(0)
 	, m_indexIterator(0)
+	, m_committedVertexCount(0)
+	, m_shadowQuadCount(0)
 	, m_renderAPI(std::move(renderAPI))
 {
 	GrowBuffers(k_initialBufferSize);
@@ -28,6 +40,7 @@ void TextRenderer::GrowBuffers(uint32_t size)
 		m_maxVertexBufferSize = NextPowerOf2(size);
 
 		m_vertexBuffer = static_cast<Vertex*>(realloc(m_vertexBuffer, m_maxVertexBufferSize * sizeof(Vertex)));
+		m_pageSortedBuffer = static_cast<Vertex*>(realloc(m_pageSortedBuffer, m_maxVertexBufferSize * sizeof(Vertex)));
 		m_indexBuffer = static_cast<uint16_t*>(realloc(m_indexBuffer, m_maxVertexBufferSize * 6 / 4 * sizeof(uint16_t)));
 
 		int vertexIterator = 0;
@@ -50,13 +63,18 @@ void TextRenderer::GrowBuffers(uint32_t size)
 TextRenderer::~TextRenderer()
 {
 	free(m_vertexBuffer);
+	free(m_pageSortedBuffer);
 	free(m_indexBuffer);
 	m_vertexBuffer = nullptr;
+	m_pageSortedBuffer = nullptr;
 	m_indexBuffer = nullptr;
 }
 
-void TextRenderer::SumbitGlyphString(const GlyphString& glyphString, const ivec2& _position, u16vec2 dpi, const Font& font, Align::Enum alignment, float true_hight)
+void TextRenderer::SumbitGlyphString(const GlyphString& glyphString, const ivec2& _position, u16vec2 dpi, const Font& font, Align::Enum alignment, float true_hight, bool distanceField)
 {
+	bool effect = distanceField && (font.stroke != 0 || font.glow != 0);
+	bool shadow = distanceField && font.shadowColor != 0;
+
 	ivec2 position = toPixel(_position * 256, dpi);
 	int scale = (int)(true_hight * 256.f / font.height);
 	if (true_hight == 0.f) scale = 256;
@@ -84,13 +102,46 @@ void TextRenderer::SumbitGlyphString(const GlyphString& glyphString, const ivec2
 		highestPoint = std::min(glyphPosition.y - (glyph.m_metrics.ascender.v * scale + 31) / 64, highestPoint);
 		lowestPoint = std::max(glyphPosition.y - (glyph.m_metrics.descender.v * scale + 31) / 64, lowestPoint);
 
-		ivec2 bitmapPos = glyphPosition + ivec2(glyph.m_metrics.horizontalBearing.x, -glyph.m_metrics.horizontalBearing.y) * scale;
+		int bitmapScale = scale * glyph.m_bitmapScale / 256;
+		ivec2 bitmapPos = glyphPosition + ivec2(glyph.m_metrics.horizontalBearing.x, -glyph.m_metrics.horizontalBearing.y) * bitmapScale;
+
+		uint32_t effectColor = 0;
+		int effectEdge = 128;
+		int effectSoftness = 0;
+		if (effect)
+		{
+			// widths are in pixels at the font size, the field drops by 32 per texel of the glyph's bitmap
+			effectColor = font.effectColor;
+			effectEdge = std::max(128 - font.stroke * 32 * 256 / glyph.m_bitmapScale, 0);
+			effectSoftness = std::min(font.glow * 32 * 256 / glyph.m_bitmapScale, effectEdge);
+		}
 
-		SubmitGlyph((bitmapPos + 127) / 256, glyph, scale);
+		SubmitGlyph((bitmapPos + 127) / 256, glyph, bitmapScale, effectColor, effectEdge, effectSoftness);
 		glyphPosition.x += (glyph.m_metrics.horiAdvance.v * scale + 31) / 64;
 		textMaxWidth = std::max(glyphPosition.x, textMaxWidth);
 	}
 
+	if (shadow)
+	{
+		// the shadows go under all the glyphs of the string, the quads are copied after them and turned into shadows
+		int count = m_vertexIterator - startVertex;
+		GrowBuffers(m_vertexIterator + count);
+		memcpy(m_vertexBuffer + m_vertexIterator, m_vertexBuffer + startVertex, count * sizeof(Vertex));
+		i16vec2 offset = i16vec2((toPixel(ivec2(font.shadowX, font.shadowY) * scale, dpi) + 127) / 256);
+		for (int i = startVertex; i != m_vertexIterator; ++i)
+		{
+			Vertex& v = m_vertexBuffer[i];
+			v.pos += offset;
+			v.color = font.shadowColor;
+			v.effectColor = v.effectColor != 0 ? font.shadowColor : 0;
+		}
+		m_indexIterator += count / 4 * 6;
+		m_vertexIterator += count;
+		m_quadLayers.resize(m_vertexIterator / 4, k_glyphLayer);
+		std::fill(m_quadLayers.begin() + startVertex / 4, m_quadLayers.begin() + startVertex / 4 + count / 4, (uint8_t)k_shadowLayer);
+		m_shadowQuadCount += count / 4;
+	}
+
 	textMaxWidth -= position.x;
 	highestPoint -= position.y;
 	lowestPoint -= position.y;
@@ -133,16 +184,20 @@ void TextRenderer::SumbitGlyphString(const GlyphString& glyphString, const ivec2
 	}
 }
 
-void TextRenderer::SubmitGlyph(const ivec2& position, const Glyph& glyph, uint16_t scale)
+void TextRenderer::SubmitGlyph(const ivec2& position, const Glyph& glyph, int scale, uint32_t effectColor, uint8_t effectEdge, uint8_t effectSoftness)
 {
 	//glyph.m_metrics.glyphSize, glyph.m_cacheUV, glyph.m_cacheUV + glyph.m_metrics.glyphSize, ge.r, ge.g, ge.b, ge.a;
 
 	Vertex vdefault;
 	vdefault.color = glyph.m_color;
+	vdefault.page = glyph.m_cachePage;
+	vdefault.effectColor = effectColor;
+	vdefault.effectEdge = effectEdge;
+	vdefault.effectSoftness = effectSoftness;
 	Vertex v0(vdefault), v1(vdefault), v2(vdefault), v3(vdefault);
 
 	v0.pos = i16vec2(position);
-	v3.pos = i16vec2(position) + i16vec2((glyph.m_metrics.glyphSize * scale) / (unsigned short)256U);
+	v3.pos = i16vec2(position) + i16vec2((ivec2(glyph.m_metrics.glyphSize) * scale) / 256);
 	v1.pos.y = v0.pos.y;
 	v2.pos.x = v0.pos.x;
 	v1.pos.x = v3.pos.x;
@@ -163,12 +218,58 @@ void TextRenderer::SubmitGlyph(const ivec2& position, const Glyph& glyph, uint16
 	m_vertexBuffer[m_vertexIterator + 3] = v3;
 	m_indexIterator += 6;
 	m_vertexIterator += 4;
+	m_quadLayers.push_back(k_glyphLayer);
 }
 
 void TextRenderer::CommitStashed()
 {
-	m_renderAPI->Render(m_vertexBuffer, m_indexBuffer, m_vertexIterator, m_indexIterator / 3);
+	int quadCount = m_vertexIterator / 4;
+	int pageCount = 1;
+	for (int i = 0; i < quadCount; ++i)
+	{
+		pageCount = std::max(pageCount, m_vertexBuffer[4 * i].page + 1);
+	}
+
+	if (pageCount == 1 && m_shadowQuadCount == 0)
+	{
+		m_renderAPI->Render(0, m_vertexBuffer, m_indexBuffer, m_vertexIterator, m_indexIterator / 3);
+	}
+	else
+	{
+		// sorted by layer and page, quads of a layer and page keep the order they were submitted in
+		int bucketCount = k_layerCount * pageCount;
+		m_pageQuads.assign(bucketCount + 1, 0);
+		for (int i = 0; i < quadCount; ++i)
+		{
+			++m_pageQuads[m_quadLayers[i] * pageCount + m_vertexBuffer[4 * i].page + 1];
+		}
+		for (int bucket = 0; bucket < bucketCount; ++bucket)
+		{
+			m_pageQuads[bucket + 1] += m_pageQuads[bucket];
+		}
+		for (int i = 0; i < quadCount; ++i)
+		{
+			int quad = m_pageQuads[m_quadLayers[i] * pageCount + m_vertexBuffer[4 * i].page]++;
+			memcpy(m_pageSortedBuffer + 4 * quad, m_vertexBuffer + 4 * i, 4 * sizeof(Vertex));
+		}
+		// The counts were advanced to the end of each bucket. With a single page the layers follow each other in one
+		// draw.
+		int bucketsPerDraw = pageCount == 1 ? bucketCount : 1;
+		for (int bucket = 0, first = 0; bucket < bucketCount; bucket += bucketsPerDraw)
+		{
+			int end = m_pageQuads[bucket + bucketsPerDraw - 1];
+			int count = end - first;
+			if (count != 0)
+			{
+				m_renderAPI->Render(bucket % pageCount, m_pageSortedBuffer + 4 * first, m_indexBuffer, count * 4, count * 2);
+			}
+			first = end;
+		}
+	}
 
+	m_committedVertexCount = m_vertexIterator;
 	m_indexIterator = 0;
 	m_vertexIterator = 0;
+	m_quadLayers.clear();
+	m_shadowQuadCount = 0;
 }
@@ -15,19 +15,30 @@ namespace Scriber
 		TextRenderer(IRenderAPIPtr renderAPI);
 		~TextRenderer();
 
-		void SumbitGlyphString(const GlyphString& glyphString, const ivec2& position, u16vec2 dpi, const Font& font, Align::Enum alignment, float true_hight);
+		// Distance field glyphs get the outline, glow and shadow of the font as vertex parameters
+		void SumbitGlyphString(const GlyphString& glyphString, const ivec2& position, u16vec2 dpi, const Font& font, Align::Enum alignment, float true_hight, bool distanceField);
 
 		void CommitStashed();
+
+		// Vertices of the last committed frame, valid until the next glyph string is submitted
+		const Vertex* GetCommittedVertices(int& count) const { count = m_committedVertexCount; return m_vertexBuffer; }
 	private:
-		void SubmitGlyph(const ivec2& position, const Glyph& glyph, uint16_t scale);
+		void SubmitGlyph(const ivec2& position, const Glyph& glyph, int scale, uint32_t effectColor, uint8_t effectEdge, uint8_t effectSoftness);
 		
 		void GrowBuffers(uint32_t size);
 
 		int m_maxVertexBufferSize;
 		Vertex* m_vertexBuffer;
+		Vertex* m_pageSortedBuffer;
+		// quads of each layer and page, the layers are drawn one after the other, each page by page
+		std::vector<int> m_pageQuads;
+		// layer of each submitted quad
+		std::vector<uint8_t> m_quadLayers;
 		uint16_t* m_indexBuffer;
 		uint16_t m_vertexIterator;
 		uint16_t m_indexIterator;
+		int m_committedVertexCount;
+		int m_shadowQuadCount;
 
 		IRenderAPIPtr m_renderAPI;
 	};
@@ -0,0 +1,419 @@
+#pragma once
+#include "sdfRasterizer.h"
+
+namespace Scriber
+{
+	namespace detail
+	{
+		enum EdgeColor: uint8_t
+		{
+			EdgeBlack   = 0,
+			EdgeRed     = 1,
+			EdgeGreen   = 2,
+			EdgeYellow  = EdgeRed | EdgeGreen,
+			EdgeBlue    = 4,
+			EdgeMagenta = EdgeRed | EdgeBlue,
+			EdgeCyan    = EdgeGreen | EdgeBlue,
+			EdgeWhite   = EdgeRed | EdgeGreen | EdgeBlue
+		};
+
+		// Line p[0]->p[1], or conic p[0]->p[2] with the control point p[1]
+		struct MSDFEdge
+		{
+			SegmentType type;
+			vec2 p[3];
+			uint8_t color;
+		};
+
+		struct EdgeDistance
+		{
+			// positive to the left of the edge direction
+			float distance;
+			// |cos| of the angle between the edge and the direction to the point, smaller is more orthogonal
+			float dot;
+			float t;
+		};
+
+		inline vec2 EdgeDirection(const MSDFEdge& e, float t)
+		{
+			if (e.type == SegmentLine)
+			{
+				return e.p[1] - e.p[0];
+			}
+			vec2 d = (e.p[1] - e.p[0]) * (1.0f - t) + (e.p[2] - e.p[1]) * t;
+			if (d == vec2(0.0f))
+			{
+				return e.p[2] - e.p[0];
+			}
+			return d;
+		}
+
+		inline vec2 EdgeEnd(const MSDFEdge& e)
+		{
+			return e.type == SegmentLine ? e.p[1] : e.p[2];
+		}
+
+		// Parameter of the point of the conic closest to pos
+		inline float ConicNearest(vec2 pos, vec2 A, vec2 B, vec2 C)
+		{
+			vec2 a = B - A;
+			vec2 b = A - 2.0f * B + C;
+			vec2 c = a * 2.0f;
+			vec2 d = A - pos;
+
+			float bb = dot(b, b);
+			if (bb < 1e-8f)
+			{
+				vec2 ca = C - A;
+				return clamp(dot(pos - A, ca) / dot(ca, ca), 0.0f, 1.0f);
+			}
+			float kk = 1.0f / bb;
+			float kx = kk * dot(a, b);
+			float ky = kk * (2.0f * dot(a, a) + dot(d, b)) / 3.0f;
+			float kz = kk * dot(d, a);
+
+			float p = ky - kx * kx;
+			float p3 = p * p * p;
+			float q = kx * (2.0f * kx * kx - 3.0f * ky) + kz;
+			float h = q * q + 4.0f * p3;
+
+			if (h >= 0.0f)
+			{   // 1 root
+				h = std::sqrt(h);
+				return clamp(std::cbrt((h - q) / 2.0f) + std::cbrt((-h - q) / 2.0f) - kx, 0.0f, 1.0f);
+			}
+			// 3 roots
+			float z = std::sqrt(-p);
+			float v = std::acos(clamp(q / (p * z * 2.0f), -1.0f, 1.0f)) / 3.0f;
+			float m = std::cos(v);
+			float n = std::sin(v) * 1.732050808f;
+			float t0 = clamp((m + m) * z - kx, 0.0f, 1.0f);
+			float t1 = clamp((-n - m) * z - kx, 0.0f, 1.0f);
+			float d0 = dot2(d + (c + b * t0) * t0);
+			float d1 = dot2(d + (c + b * t1) * t1);
+			return d0 <= d1 ? t0 : t1;
+		}
+
+		inline EdgeDistance SignedDistance(const MSDFEdge& e, vec2 pos)
+		{
+			EdgeDistance r;
+			vec2 q;
+			if (e.type == SegmentLine)
+			{
+				vec2 ab = e.p[1] - e.p[0];
+				r.t = clamp(dot(pos - e.p[0], ab) / dot(ab, ab), 0.0f, 1.0f);
+				q = e.p[0] + ab * r.t;
+			}
+			else
+			{
+				r.t = ConicNearest(pos, e.p[0], e.p[1], e.p[2]);
+				float t = r.t;
+				q = e.p[0] * ((1.0f - t) * (1.0f - t)) + e.p[1] * (2.0f * t * (1.0f - t)) + e.p[2] * (t * t);
+			}
+			vec2 dir = EdgeDirection(e, r.t);
+			vec2 v = pos - q;
+			float len = length(v);
+			r.distance = cross2(dir, v) < 0.0f ? -len : len;
+			r.dot = len > 0.0f ? std::abs(dot(dir, v)) / (length(dir) * len) : 0.0f;
+			return r;
+		}
+
+		inline bool Closer(const EdgeDistance& a, const EdgeDistance& b)
+		{
+			float da = std::abs(a.distance);
+			float db = std::abs(b.distance);
+			if (std::abs(da - db) <= 1e-4f)
+			{
+				return a.dot < b.dot;
+			}
+			return da < db;
+		}
+
+		// Distance to the edge extended along its tangents at the end points, so that the channels meet at corners with
+		// straight boundaries instead of rounding them.
+		inline float PseudoDistance(const MSDFEdge& e, const EdgeDistance& d, vec2 pos)
+		{
+			if (d.t <= 0.0f)
+			{
+				vec2 dir = normalize(EdgeDirection(e, 0.0f));
+				vec2 v = pos - e.p[0];
+				if (dot(v, dir) < 0.0f)
+				{
+					float pd = cross2(dir, v);
+					if (std::abs(pd) <= std::abs(d.distance))
+					{
+						return pd;
+					}
+				}
+			}
+			else if (d.t >= 1.0f)
+			{
+				vec2 dir = normalize(EdgeDirection(e, 1.0f));
+				vec2 v = pos - EdgeEnd(e);
+				if (dot(v, dir) > 0.0f)
+				{
+					float pd = cross2(dir, v);
+					if (std::abs(pd) <= std::abs(d.distance))
+					{
+						return pd;
+					}
+				}
+			}
+			return d.distance;
+		}
+
+		inline bool IsCorner(vec2 a, vec2 b)
+		{
+			// sin(3 rad), the smallest turn that is kept sharp
+			const float crossThreshold = 0.14112f;
+			return dot(a, b) <= 0.0f || std::abs(cross2(a, b)) > crossThreshold;
+		}
+
+		// Colors the edges of each contour so that the two edges meeting at a corner only share one channel. A smooth
+		// contour is white, a contour with one corner is split into three colored parts.
+		inline void ColorEdges(std::vector<MSDFEdge>& edges, const std::vector<int>& contours, std::vector<int>& corners)
+		{
+			static const uint8_t cycle[3] = {EdgeCyan, EdgeMagenta, EdgeYellow};
+
+			for (size_t c = 0; c + 1 < contours.size(); ++c)
+			{
+				MSDFEdge* contour = &edges[contours[c]];
+				int m = contours[c + 1] - contours[c];
+
+				corners.clear();
+				for (int i = 0; i < m; ++i)
+				{
+					vec2 a = normalize(EdgeDirection(contour[(i + m - 1) % m], 1.0f));
+					vec2 b = normalize(EdgeDirection(contour[i], 0.0f));
+					if (IsCorner(a, b))
+					{
+						corners.push_back(i);
+					}
+				}
+
+				if (corners.empty() || (corners.size() == 1 && m < 3))
+				{
+					for (int i = 0; i < m; ++i)
+					{
+						contour[i].color = EdgeWhite;
+					}
+				}
+				else if (corners.size() == 1)
+				{
+					static const uint8_t teardrop[3] = {EdgeMagenta, EdgeWhite, EdgeYellow};
+					for (int i = 0; i < m; ++i)
+					{
+						int third = int(3.0f + 2.875f * i / (m - 1) - 1.4375f + 0.5f) - 3;
+						contour[(corners[0] + i) % m].color = teardrop[1 + third];
+					}
+				}
+				else
+				{
+					int cornerCount = (int)corners.size();
+					int spline = 0;
+					int color = 0;
+					for (int i = 0; i < m; ++i)
+					{
+						int index = (corners[0] + i) % m;
+						if (spline + 1 < cornerCount && corners[spline + 1] == index)
+						{
+							++spline;
+							color = (color + 1) % 3;
+							// the last part also meets the first one
+							if (spline == cornerCount - 1 && color == 0)
+							{
+								color = 1;
+							}
+						}
+						contour[index].color = cycle[color];
+					}
+				}
+			}
+		}
+
+		inline uint8_t ToDistanceValue(float d, float scale, float bias)
+		{
+			float x = clamp(d * scale + bias, 0.0f, 255.0f);
+			return uint8_t(255 - int(x));
+		}
+
+		inline float Median(float a, float b, float c)
+		{
+			return max(min(a, b), min(max(a, b), c));
+		}
+
+		// Scalar multi-channel kernel. Segments of the job are not used, the tiles index the edges instead.
+		inline void RenderMSDFTiles(const SDFJob& job, const std::vector<MSDFEdge>& edges, float orientation)
+		{
+			const float farDistance = (max(job.bias, 255.0f - job.bias) / job.scale + 1.0f) * 2.0f;
+			const int width = job.width;
+
+			for (int t = 0; t < job.tileCount; ++t)
+			{
+				const SDFTile& tile = job.tiles[t];
+
+				for (int j = tile.y; j < tile.y + tile.height; ++j)
+				{
+					uint8_t* row = job.output + 3 * (j * width);
+					const uint8_t* inside = job.inside + j * width;
+					float y = job.originY + float(job.height - 1 - j);
+
+					for (int i = tile.x; i < tile.x + tile.width; ++i)
+					{
+						uint8_t* pixel = row + 3 * i;
+						if (tile.nearCount == 0)
+						{
+							memset(pixel, tile.fill, 3);
+							continue;
+						}
+						vec2 pos(job.originX + float(i), y);
+
+						EdgeDistance best[3];
+						int bestEdge[3] = {-1, -1, -1};
+						float minDistance = farDistance;
+						for (int k = 0; k < tile.nearCount; ++k)
+						{
+							int s = tile.nearSegments[k];
+							const MSDFEdge& e = edges[s];
+							EdgeDistance d = SignedDistance(e, pos);
+							minDistance = min(minDistance, std::abs(d.distance));
+							for (int c = 0; c < 3; ++c)
+							{
+								if ((e.color & (1 << c)) && (bestEdge[c] < 0 || Closer(d, best[c])))
+								{
+									best[c] = d;
+									bestEdge[c] = s;
+								}
+							}
+						}
+
+						float sign = inside[i] ? -1.0f : 1.0f;
+						float channel[3];
+						for (int c = 0; c < 3; ++c)
+						{
+							if (bestEdge[c] < 0)
+							{
+								channel[c] = sign * farDistance;
+							}
+							else
+							{
+								channel[c] = orientation * PseudoDistance(edges[bestEdge[c]], best[c], pos);
+							}
+						}
+
+						// where the median disagrees with the fill rule, e.g. on overlapping contours, fall back to
+						// the true distance in all channels
+						if ((Median(channel[0], channel[1], channel[2]) < 0.0f) != (inside[i] != 0))
+						{
+							channel[0] = channel[1] = channel[2] = sign * minDistance;
+						}
+						for (int c = 0; c < 3; ++c)
+						{
+							pixel[c] = ToDistanceValue(channel[c], job.scale, job.bias);
+						}
+					}
+				}
+			}
+		}
+
+		inline void BuildEdges(std::vector<MSDFEdge>& edges, std::vector<int>& contours, const vec2* points, const Command* commands)
+		{
+			const vec2* p = points;
+			--p;
+			for (const Command* cmd = commands; *cmd != End; ++cmd)
+			{
+				MSDFEdge e;
+				switch (*cmd)
+				{
+					case MoveTo:
+						contours.push_back((int)edges.size());
+						++p;
+						continue;
+					case LineTo:
+						e.type = SegmentLine;
+						e.p[0] = p[0];
+						e.p[1] = p[1];
+						e.p[2] = p[1];
+						++p;
+						break;
+					case ConicTo:
+						e.type = SegmentConic;
+						e.p[0] = p[0];
+						e.p[1] = p[1];
+						e.p[2] = p[2];
+						p += 2;
+						break;
+					case End:
+						continue;
+				}
+				e.color = EdgeWhite;
+				edges.push_back(e);
+			}
+			contours.push_back((int)edges.size());
+		}
+
+		// Per thread scratch of the MSDF generator, in addition to the OutlineArena
+		struct MSDFArena
+		{
+			std::vector<MSDFEdge> edges;
+			std::vector<int> contours;
+			std::vector<int> corners;
+		};
+
+		inline MSDFArena& GetMSDFArena()
+		{
+			static thread_local MSDFArena arena;
+			return arena;
+		}
+	}
+
+	// Multi-channel SDF, three bytes per pixel. The median of the channels gives the same value as RenderSDF, except
+	// that corners stay sharp when the bitmap is magnified. The pixels are stored in `buffer`, see detail::SetupBitmap.
+	inline FT_BitmapGlyph RenderMSDF(int margin, float cutoff, const FT_Outline& outline, std::vector<uint8_t>& buffer, FT_BitmapGlyphRec_& bitmap)
+	{
+		memset(&bitmap, 0, sizeof(FT_BitmapGlyphRec_));
+		bitmap.root.format = FT_GLYPH_FORMAT_BITMAP;
+
+		detail::SetupBitmap(bitmap, outline, margin, 3, buffer);
+		detail::OutlineArena& arena = detail::GetOutlineArena();
+		detail::MSDFArena& msdfArena = detail::GetMSDFArena();
+
+		int cmd_count = detail::DecomposeOutline(outline, arena.points, arena.commands);
+		if (cmd_count < 0)
+		{
+			return &bitmap;
+		}
+		const vec2* points = arena.points.data();
+		const detail::Command* commands = arena.commands.data();
+
+		int radius = 8;
+		float radius_by_256 = (256.0f / radius);
+
+		std::vector<detail::MSDFEdge>& edges = msdfArena.edges;
+		edges.clear();
+		msdfArena.contours.clear();
+		detail::BuildEdges(edges, msdfArena.contours, points, commands);
+		detail::ColorEdges(edges, msdfArena.contours, msdfArena.corners);
+
+		detail::SDFJob job;
+		job.segments = nullptr;
+		job.segmentCount = (int)edges.size();
+		job.width = bitmap.bitmap.width;
+		job.height = bitmap.bitmap.rows;
+		job.originX = bitmap.left + 0.513f;
+		job.originY = bitmap.top - (int)bitmap.bitmap.rows + 0.507f;
+		job.scale = radius_by_256;
+		job.bias = cutoff * 256.0f;
+		job.output = bitmap.bitmap.buffer;
+		job.skipSaturated = false;
+
+		detail::BuildTileGrid(arena.grid, points, commands, job);
+		detail::BuildInsideMask(arena.grid, arena.crossings, points, commands, job);
+
+		// edges are left-positive, outside has to be positive
+		float orientation = FT_Outline_Get_Orientation(const_cast<FT_Outline*>(&outline)) == FT_ORIENTATION_POSTSCRIPT ? -1.0f : 1.0f;
+		detail::RenderMSDFTiles(job, edges, orientation);
+
+		return &bitmap;
+	}
+}
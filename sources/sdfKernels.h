@@ -0,0 +1,104 @@
+#pragma once
+#include "Attributes.h"
+#include <stdint.h>
+
+namespace Scriber
+{
+	namespace detail
+	{
+		enum SegmentType: uint32_t
+		{
+			SegmentLine,
+			SegmentConic
+		};
+
+		// Per-segment constants, computed once per glyph so that the kernels only do per-pixel work.
+		// Line:  p0 = A, p1 = B, a = B - A, k = 1 / dot(a, a).
+		// Conic: p0 = A, p1 = C, a = B - A, b = A - 2B + C, k = 1 / dot(b, b), kx = k * dot(a, b), aa = 2 * dot(a, a).
+		struct SDFSegment
+		{
+			SegmentType type;
+			float p0x, p0y;
+			float p1x, p1y;
+			float ax, ay;
+			float bx, by;
+			float k, kx, aa;
+		};
+
+		enum
+		{
+			k_sdfTileSize = 16,
+			// Side of the blocks of the coarse pass, see SDFJob::skipSaturated
+			k_sdfBlockSize = 4
+		};
+
+		// Rectangle of the output with the segments that can be closer than the saturation distance to some of its
+		// pixels. A tile without such segments is filled with the constant fill value instead.
+		struct SDFTile
+		{
+			int x;
+			int y;
+			int width;
+			int height;
+			const uint32_t* nearSegments;
+			int nearCount;
+			uint8_t fill;
+		};
+
+		// Pixel (i, j) of the output, with row 0 at the top, is sampled at (originX + i, originY + height - 1 - j).
+		// The stored value is 255 - clamp(distance * scale + bias, 0, 255), distance is negative where inside is not zero.
+		// With skipSaturated the distance is first evaluated at the center of each block of a tile. A block whose center
+		// is farther than the saturation distance plus its half diagonal only has saturated pixels, they are filled from
+		// the inside mask. The output is the same either way.
+		struct SDFJob
+		{
+			const SDFSegment* segments;
+			int segmentCount;
+			const SDFTile* tiles;
+			int tileCount;
+			int width;
+			int height;
+			float originX;
+			float originY;
+			float scale;
+			float bias;
+			const uint8_t* inside;
+			uint8_t* output;
+			bool skipSaturated;
+		};
+
+		// Returns the number of pixels that were filled without evaluating their distance
+		typedef int (*SDFKernel)(const SDFJob& job);
+
+		// Each returns nullptr if the library was built without that instruction set.
+		SDFKernel GetSDFKernel_Default();
+		SDFKernel GetSDFKernel_AVX2();
+		SDFKernel GetSDFKernel_AVX512();
+
+		// Kernel for the active SIMD level, see SetSDFSIMDLevel.
+		SDFKernel GetSDFKernel();
+
+		// Forces a specific kernel. Levels that are not supported by the CPU or by the build fall back to the best available one.
+		void SetSDFSIMDLevel(SIMDLevel::Enum level);
+
+		SIMDLevel::Enum GetSDFSIMDLevel();
+
+		// Coarse pass of the SDF kernels, on by default. Only meant for comparisons, the output does not depend on it.
+		void SetSDFSkipSaturated(bool enable);
+
+		bool GetSDFSkipSaturated();
+
+		struct SDFStats
+		{
+			uint64_t pixels;
+			uint64_t skippedPixels; // filled without evaluating their distance, in empty tiles or saturated blocks
+		};
+
+		// Totals of the exact SDF generator over all threads since the last reset
+		SDFStats GetSDFStats();
+
+		void ResetSDFStats();
+
+		void AddSDFStats(int pixels, int skippedPixels);
+	}
+}
@@ -0,0 +1,217 @@
+// Body of the SDF kernels. It is included by the sdfKernels_*.cpp files, each of them compiled for its own
+// instruction set, and must not be included anywhere else.
+// Everything here has internal linkage and only uses the simd.h vocabulary on plain floats: an inline function
+// with external linkage built with AVX enabled could otherwise be picked by the linker for the baseline path.
+#include "sdfKernels.h"
+#include "simd.h"
+
+#include <string.h>
+
+namespace Scriber
+{
+	namespace detail
+	{
+		namespace
+		{
+			using simd::vfloat;
+			using simd::vmask;
+
+			// squared distance to a line segment
+			inline vfloat sdLineSIMD(vfloat posx, vfloat posy, const SDFSegment& s)
+			{
+				vfloat bax = VSET(s.ax);
+				vfloat bay = VSET(s.ay);
+				vfloat pax = VSUB(posx, VSET(s.p0x));
+				vfloat pay = VSUB(posy, VSET(s.p0y));
+				vfloat h = VMAX(VMIN(VMUL(VADD(VMUL(pax, bax), VMUL(pay, bay)), VSET(s.k)), VSET(1.0f)), VSET(0.0f));
+				vfloat vdx = VSUB(pax, VMUL(bax, h));
+				vfloat vdy = VSUB(pay, VMUL(bay, h));
+				return VADD(VMUL(vdx, vdx), VMUL(vdy, vdy));
+			}
+
+			// squared distance to a quadratic bezier
+			inline vfloat sdBezierSIMD(vfloat posx, vfloat posy, const SDFSegment& s)
+			{
+				vfloat bx = VSET(s.bx);
+				vfloat by = VSET(s.by);
+				vfloat cx = VSET(s.ax * 2.0f);
+				vfloat cy = VSET(s.ay * 2.0f);
+				vfloat dx = VSUB(VSET(s.p0x), posx);
+				vfloat dy = VSUB(VSET(s.p0y), posy);
+
+				vfloat kx = VSET(s.kx);
+				vfloat ky = VMUL(VSET(s.k / 3.0f), VADD(VSET(s.aa), VADD(VMUL(dx, bx), VMUL(dy, by))));
+				vfloat kz = VMUL(VSET(s.k), VADD(VMUL(dx, VSET(s.ax)), VMUL(dy, VSET(s.ay))));
+
+				vfloat p = VSUB(ky, VMUL(kx, kx));
+				vfloat p3 = VMUL(VMUL(p, p), p);
+				vfloat q = VADD(VMUL(kx, VSUB(VMUL(VSET(2.0f * s.kx), kx), VMUL(VSET(3.0f), ky))), kz);
+				vfloat h = VADD(VMUL(q, q), VMUL(VSET(4.0f), p3));
+
+				vfloat zero = VSET(0.0f);
+				vfloat one = VSET(1.0f);
+
+				// 1 root
+				vfloat hs = SQRT(VMAX(h, zero));
+				vfloat t0 = VSUB(VADD(simd::vcbrt(VMUL(VSUB(hs, q), VSET(0.5f))), simd::vcbrt(VMUL(VSUB(VNEG(hs), q), VSET(0.5f)))), kx);
+				t0 = VMAX(VMIN(t0, one), zero);
+
+				// 3 roots
+				vfloat z = SQRT(VMAX(VNEG(p), zero));
+				vfloat v = VMUL(simd::vacos(VDIV(q, VMUL(VMUL(p, z), VSET(2.0f)))), VSET(1.0f / 3.0f));
+				vfloat m, n;
+				simd::vsincos_pi3(v, n, m);
+				n = VMUL(n, VSET(1.732050808f));
+				vfloat t1 = VMAX(VMIN(VSUB(VMUL(VADD(m, m), z), kx), one), zero);
+				vfloat t2 = VMAX(VMIN(VSUB(VMUL(VNEG(VADD(n, m)), z), kx), one), zero);
+
+				vfloat roots[3] = {t0, t1, t2};
+				vfloat dist[3];
+				for (int i = 0; i < 3; ++i)
+				{
+					vfloat t = roots[i];
+					// q = d + (c + b * t) * t
+					vfloat qx = VADD(dx, VMUL(VADD(cx, VMUL(bx, t)), t));
+					vfloat qy = VADD(dy, VMUL(VADD(cy, VMUL(by, t)), t));
+					dist[i] = VADD(VMUL(qx, qx), VMUL(qy, qy));
+				}
+				return VSEL(VCMPLE(zero, h), dist[0], VMIN(dist[1], dist[2]));
+			}
+
+			// squared distance to the nearest of the tile's segments
+			inline vfloat sdTileSIMD(vfloat posx, vfloat posy, const SDFTile& tile, const SDFSegment* segments)
+			{
+				vfloat d2 = VSET(1e12f);
+				for (const uint32_t* __restrict s = tile.nearSegments, *e = s + tile.nearCount; s != e; ++s)
+				{
+					const SDFSegment& segment = segments[*s];
+					if (segment.type == SegmentLine)
+					{
+						d2 = VMIN(d2, sdLineSIMD(posx, posy, segment));
+					}
+					else
+					{
+						d2 = VMIN(d2, sdBezierSIMD(posx, posy, segment));
+					}
+				}
+				return d2;
+			}
+
+			int RenderSDFTiles(const SDFJob& job)
+			{
+				enum
+				{
+					k_blocksPerSide = k_sdfTileSize / k_sdfBlockSize,
+					k_blocksPerTile = k_blocksPerSide * k_blocksPerSide,
+					// a vector covers k_sdfBlockSize columns and k_rowsPerVector rows of a block
+					k_rowsPerVector = SIMD_WIDTH / k_sdfBlockSize
+				};
+				static_assert(k_blocksPerTile % SIMD_WIDTH == 0 && SIMD_WIDTH % k_sdfBlockSize == 0, "blocks must map to whole vectors");
+
+				const int width = job.width;
+				const int height = job.height;
+				const SDFSegment* segments = job.segments;
+
+				// beyond that the output is clamped, with 1/64 of a pixel to spare, and pixel centers of a block are within
+				// the half diagonal of its center
+				const float saturation = (job.bias > 255.0f - job.bias ? job.bias : 255.0f - job.bias) / job.scale + 1.0f / 64.0f;
+				const float halfDiagonal = float(k_sdfBlockSize - 1) * 0.70710678f;
+				const float threshold = (saturation + halfDiagonal) * (saturation + halfDiagonal);
+
+				float laneX[SIMD_WIDTH];
+				float laneY[SIMD_WIDTH];
+				for (int k = 0; k < SIMD_WIDTH; ++k)
+				{
+					laneX[k] = float(k % k_sdfBlockSize);
+					laneY[k] = -float(k / k_sdfBlockSize);
+				}
+				const vfloat vlaneX = VLD(laneX);
+				const vfloat vlaneY = VLD(laneY);
+
+				int skipped = 0;
+
+				// single threaded, glyphs are rasterized in parallel instead, see GlyphBitmapStash::PrefetchGlyphs
+				for (int t = 0; t < job.tileCount; ++t)
+				{
+					const SDFTile& tile = job.tiles[t];
+
+					if (tile.nearCount == 0)
+					{
+						for (int j = tile.y; j < tile.y + tile.height; ++j)
+						{
+							memset(job.output + j * width + tile.x, tile.fill, tile.width);
+						}
+						skipped += tile.width * tile.height;
+						continue;
+					}
+
+					uint8_t saturated[k_blocksPerTile] = {};
+					if (job.skipSaturated)
+					{
+						float cx[k_blocksPerTile];
+						float cy[k_blocksPerTile];
+						for (int b = 0; b < k_blocksPerTile; ++b)
+						{
+							cx[b] = job.originX + float(tile.x + (b % k_blocksPerSide) * k_sdfBlockSize) + 0.5f * (k_sdfBlockSize - 1);
+							cy[b] = job.originY + float(height - 1 - tile.y - (b / k_blocksPerSide) * k_sdfBlockSize) - 0.5f * (k_sdfBlockSize - 1);
+						}
+						for (int b = 0; b < k_blocksPerTile; b += SIMD_WIDTH)
+						{
+							float d2[SIMD_WIDTH];
+							VSTORE(d2, sdTileSIMD(VLD(cx + b), VLD(cy + b), tile, segments));
+							for (int k = 0; k < SIMD_WIDTH; ++k)
+							{
+								saturated[b + k] = d2[k] > threshold;
+							}
+						}
+					}
+
+					for (int by = 0; by * k_sdfBlockSize < tile.height; ++by)
+					{
+						int y0 = tile.y + by * k_sdfBlockSize;
+						int rows = tile.y + tile.height - y0 < k_sdfBlockSize ? tile.y + tile.height - y0 : int(k_sdfBlockSize);
+						for (int bx = 0; bx * k_sdfBlockSize < tile.width; ++bx)
+						{
+							int x0 = tile.x + bx * k_sdfBlockSize;
+							int columns = tile.x + tile.width - x0 < k_sdfBlockSize ? tile.x + tile.width - x0 : int(k_sdfBlockSize);
+
+							if (saturated[by * k_blocksPerSide + bx])
+							{
+								for (int j = y0; j < y0 + rows; ++j)
+								{
+									for (int i = x0; i < x0 + columns; ++i)
+									{
+										job.output[j * width + i] = job.inside[j * width + i] ? 255 : 0;
+									}
+								}
+								skipped += rows * columns;
+								continue;
+							}
+
+							vfloat posx = VADD(VSET(job.originX + float(x0)), vlaneX);
+							for (int r = 0; r < rows; r += k_rowsPerVector)
+							{
+								vfloat posy = VADD(VSET(job.originY + float(height - 1 - y0 - r)), vlaneY);
+								float v[SIMD_WIDTH];
+								VSTORE(v, VMUL(SQRT(sdTileSIMD(posx, posy, tile, segments)), VSET(job.scale)));
+								for (int k = 0; k < SIMD_WIDTH; ++k)
+								{
+									int i = x0 + k % k_sdfBlockSize;
+									int j = y0 + r + k / k_sdfBlockSize;
+									if (i >= x0 + columns || j >= y0 + rows)
+									{
+										continue;
+									}
+									float x = job.inside[j * width + i] ? job.bias - v[k] : job.bias + v[k];
+									x = x < 0.0f ? 0.0f : (x > 255.0f ? 255.0f : x);
+									job.output[j * width + i] = uint8_t(255 - int(x));
+								}
+							}
+						}
+					}
+				}
+				return skipped;
+			}
+		}
+	}
+}
@@ -0,0 +1,16 @@
+// Built with AVX2 and FMA enabled, see CMakeLists.txt. Only called after a CPUID check.
+#include "sdfKernels.h"
+
+#if defined(__AVX2__)
+#define SCRIBER_SIMD_AVX2
+#include "sdfKernelsImpl.h"
+#endif
+
+Scriber::detail::SDFKernel Scriber::detail::GetSDFKernel_AVX2()
+{
+#if defined(__AVX2__)
+	return RenderSDFTiles;
+#else
+	return nullptr;
+#endif
+}
@@ -0,0 +1,16 @@
+// Built with AVX-512F enabled, see CMakeLists.txt. Only called after a CPUID check.
+#include "sdfKernels.h"
+
+#if defined(__AVX512F__)
+#define SCRIBER_SIMD_AVX512
+#include "sdfKernelsImpl.h"
+#endif
+
+Scriber::detail::SDFKernel Scriber::detail::GetSDFKernel_AVX512()
+{
+#if defined(__AVX512F__)
+	return RenderSDFTiles;
+#else
+	return nullptr;
+#endif
+}
@@ -0,0 +1,6 @@
+#include "sdfKernelsImpl.h"
+
+Scriber::detail::SDFKernel Scriber::detail::GetSDFKernel_Default()
+{
+	return RenderSDFTiles;
+}
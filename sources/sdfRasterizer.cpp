@@ -0,0 +1,123 @@
+#include "sdfKernels.h"
+
+#include <atomic>
+
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+using namespace Scriber;
+
+static bool CPUSupports(SIMDLevel::Enum level)
+{
+	if (level == SIMDLevel::Baseline)
+	{
+		return true;
+	}
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+	int info[4];
+	__cpuid(info, 1);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!osxsave)
+	{
+		return false;
+	}
+	unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	switch (level)
+	{
+		case SIMDLevel::AVX2: return fma && (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+		case SIMDLevel::AVX512: return (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+		default: return false;
+	}
+#elif defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	__builtin_cpu_init();
+	switch (level)
+	{
+		case SIMDLevel::AVX2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		case SIMDLevel::AVX512: return __builtin_cpu_supports("avx512f");
+		default: return false;
+	}
+#else
+	return false;
+#endif
+}
+
+static detail::SDFKernel GetKernel(SIMDLevel::Enum level)
+{
+	switch (level)
+	{
+		case SIMDLevel::Baseline: return detail::GetSDFKernel_Default();
+		case SIMDLevel::AVX2: return detail::GetSDFKernel_AVX2();
+		case SIMDLevel::AVX512: return detail::GetSDFKernel_AVX512();
+		default: return nullptr;
+	}
+}
+
+static detail::SDFKernel s_kernel = nullptr;
+static SIMDLevel::Enum s_level = SIMDLevel::Auto;
+
+void detail::SetSDFSIMDLevel(SIMDLevel::Enum level)
+{
+	int l = level == SIMDLevel::Auto ? SIMDLevel::AVX512 : level;
+	for (; l > SIMDLevel::Baseline; --l)
+	{
+		if (GetKernel(SIMDLevel::Enum(l)) != nullptr && CPUSupports(SIMDLevel::Enum(l)))
+		{
+			break;
+		}
+	}
+	s_level = SIMDLevel::Enum(l);
+	s_kernel = GetKernel(s_level);
+}
+
+SIMDLevel::Enum detail::GetSDFSIMDLevel()
+{
+	if (s_kernel == nullptr)
+	{
+		SetSDFSIMDLevel(SIMDLevel::Auto);
+	}
+	return s_level;
+}
+
+detail::SDFKernel detail::GetSDFKernel()
+{
+	if (s_kernel == nullptr)
+	{
+		SetSDFSIMDLevel(SIMDLevel::Auto);
+	}
+	return s_kernel;
+}
+
+static bool s_skipSaturated = true;
+static std::atomic<uint64_t> s_pixels(0);
+static std::atomic<uint64_t> s_skippedPixels(0);
+
+void detail::SetSDFSkipSaturated(bool enable)
+{
+	s_skipSaturated = enable;
+}
+
+bool detail::GetSDFSkipSaturated()
+{
+	return s_skipSaturated;
+}
+
+detail::SDFStats detail::GetSDFStats()
+{
+	return {s_pixels.load(), s_skippedPixels.load()};
+}
+
+void detail::ResetSDFStats()
+{
+	s_pixels = 0;
+	s_skippedPixels = 0;
+}
+
+void detail::AddSDFStats(int pixels, int skippedPixels)
+{
+	s_pixels.fetch_add(pixels, std::memory_order_relaxed);
+	s_skippedPixels.fetch_add(skippedPixels, std::memory_order_relaxed);
+}
@@ -4,432 +4,783 @@
 #include <freetype.h>
 
 #include "Utils.h"
-#include "simd.h"
-
-#if !defined(SCRIBER_SDF_USE_OMP)
-#if defined(_OPENMP)
-#define SCRIBER_SDF_USE_OMP 1
-#else
-#define SCRIBER_SDF_USE_OMP 0
-#endif
-#endif
-
-#if SCRIBER_SDF_USE_OMP
-#include <omp.h>
-#endif
-
-#ifdef _MSC_VER
-#define T4_Pragma(X) __pragma(X)
-#else
-#define T4_Pragma(X) _Pragma(#X)
-#endif
-
-#if SCRIBER_SDF_USE_OMP
-#define OMP_THREAD_ID omp_get_thread_num()
-#define OMP_MAX_THREADS omp_get_max_threads()
-#define parallel_for T4_Pragma(omp parallel for) for
-#else
-#define OMP_THREAD_ID 0
-#define OMP_MAX_THREADS 1
-#define parallel_for for
-#endif
+#include "sdfKernels.h"
+
+#include <vector>
+#include <algorithm>
 
 
 namespace Scriber
 {
 	namespace detail
 	{
-		inline float sdLine(vec2 pos, vec2 A, vec2 B)
+		inline SDFSegment MakeLineSegment(vec2 A, vec2 B)
 		{
-			//printf("dd = intersection(dd, sdLine(p, vec2(%f, %f), vec2(%f, %f)));\n", A.x, A.y, B.x, B.y);
-			vec2 pa = pos - A, ba = B - A;
-			float h = clamp(dot(pa, ba) / dot(ba, ba), 0.0f, 1.0f);
-			float d = length(pa - ba * h);
+			SDFSegment s;
+			vec2 ba = B - A;
+			s.type = SegmentLine;
+			s.p0x = A.x;
+			s.p0y = A.y;
+			s.p1x = B.x;
+			s.p1y = B.y;
+			s.ax = ba.x;
+			s.ay = ba.y;
+			s.bx = 0.0f;
+			s.by = 0.0f;
+			s.k = 1.0f / dot(ba, ba);
+			s.kx = 0.0f;
+			s.aa = 0.0f;
+			return s;
+		}
 
-			float sa = cross2(A, pos);
-			float sc = cross2(ba, pa);
-			float s0 = cross2(-B, pos - B);
+		inline SDFSegment MakeConicSegment(vec2 A, vec2 B, vec2 C)
+		{
+			SDFSegment s;
+			vec2 a = B - A;
+			vec2 b = A - 2.0f * B + C;
+			s.type = SegmentConic;
+			s.p0x = A.x;
+			s.p0y = A.y;
+			s.p1x = C.x;
+			s.p1y = C.y;
+			s.ax = a.x;
+			s.ay = a.y;
+			s.bx = b.x;
+			s.by = b.y;
+			s.k = 1.0f / dot(b, b);
+			s.kx = s.k * dot(a, b);
+			s.aa = 2.0f * dot(a, a);
+			return s;
+		}
 
-			bool has_neg = (sa < 0.f) || (sc < 0.f) || (s0 < 0.f);
-			bool has_pos = (sa > 0.f) || (sc > 0.f) || (s0 > 0.f);
+		enum Command: uint8_t
+		{
+			MoveTo,
+			LineTo,
+			ConicTo,
+			End
+		};
 
-			float ts = 1.0f - float(!(has_neg && has_pos)) * 2.0f;
-			return d * ts;
-		}
+		struct Crossing
+		{
+			float x;
+			int dir;
 
-#define CROSS2(X1, X2) VSUB(VMUL(X1##x, X2##y), VMUL(X1##y, X2##x))
-#define DOT(X1, X2) VADD(VMUL(X1##x, X2##x), VMUL(X1##y, X2##y))
+			bool operator<(const Crossing& other) const
+			{
+				return x < other.x;
+			}
+		};
 
-		inline simd::f4 sdLineSIMD(float* _pos, vec2 _A, vec2 _B)
+		// Crossing of the edge A->B with the horizontal line at y. Edges are half-open in y, so that a crossing at a
+		// shared end point is counted once. dir is +1 for upward edges.
+		inline void LineCrossings(vec2 A, vec2 B, float y, std::vector<Crossing>& crossings)
 		{
-			vec2 ba = _B - _A;
-			float _dba = dot(ba, ba);
-			simd::f4 posx = VLD(_pos);
-			simd::f4 posy = VLD(_pos + 4);
-			simd::f4 Ax = VSET(_A.x);
-			simd::f4 Ay = VSET(_A.y);
-			simd::f4 Bx = VSET(_B.x);
-			simd::f4 By = VSET(_B.y);
-			simd::f4 pax = VSUB(posx, Ax);
-			simd::f4 pay = VSUB(posy, Ay);
-			simd::f4 bax = VSET(ba.x);
-			simd::f4 bay = VSET(ba.y);
-			simd::f4 dba = VSET(_dba);
-			simd::f4 h = VMAX(VMIN(VDIV(DOT(pa, ba), dba), VSET(1.0)) , VSET(0.0));
-			simd::f4 vdx = VSUB(pax, VMUL(bax, h));
-			simd::f4 vdy = VSUB(pay, VMUL(bay, h));
-			simd::f4 d = SQRT(VADD(VMUL(vdx, vdx), VMUL(vdy, vdy)));
-			simd::f4 posmBx = VSUB(posx, Bx);
-			simd::f4 posmBy = VSUB(posy, By);
-
-			simd::f4 sa = CROSS2(A, pos);
-			simd::f4 sc = CROSS2(ba, pa);
-			simd::f4 s0 = CROSS2(-B, posmB);
-
-			float sa4[4];
-			float sc4[4];
-			float s04[4];
-			VSTORE(sa4,sa);
-			VSTORE(sc4,sc);
-			VSTORE(s04,s0);
-
-			bool has_neg0 = (sa[0] < 0.f) || (sc[0] < 0.f) || (s0[0] < 0.f);
-			bool has_pos0 = (sa[0] > 0.f) || (sc[0] > 0.f) || (s0[0] > 0.f);
-			bool has_neg1 = (sa[1] < 0.f) || (sc[1] < 0.f) || (s0[1] < 0.f);
-			bool has_pos1 = (sa[1] > 0.f) || (sc[1] > 0.f) || (s0[1] > 0.f);
-			bool has_neg2 = (sa[2] < 0.f) || (sc[2] < 0.f) || (s0[2] < 0.f);
-			bool has_pos2 = (sa[2] > 0.f) || (sc[2] > 0.f) || (s0[2] > 0.f);
-			bool has_neg3 = (sa[3] < 0.f) || (sc[3] < 0.f) || (s0[3] < 0.f);
-			bool has_pos3 = (sa[3] > 0.f) || (sc[3] > 0.f) || (s0[3] > 0.f);
-
-			float ts[4] = {
-					1.0f - float(!(has_neg0 && has_pos0)) * 2.0f,
-					1.0f - float(!(has_neg1 && has_pos1)) * 2.0f,
-					1.0f - float(!(has_neg2 && has_pos2)) * 2.0f,
-					1.0f - float(!(has_neg3 && has_pos3)) * 2.0f,
-					};
-
-			return VMUL(d, VLD(ts));
+			if ((A.y <= y) == (B.y <= y))
+			{
+				return;
+			}
+			float x = A.x + (y - A.y) * (B.x - A.x) / (B.y - A.y);
+			crossings.push_back({x, B.y > A.y ? 1 : -1});
 		}
 
-		// signed distance to a quadratic bezier
-		inline float sdBezier(vec2 pos, vec2 A, vec2 B, vec2 C)
+		inline void ConicCrossings(vec2 A, vec2 B, vec2 C, float y, std::vector<Crossing>& crossings)
 		{
-			//printf("dd = intersection(dd, sdBezier(p, vec2(%f, %f), vec2(%f, %f), vec2(%f, %f)));\n", A.x, A.y, B.x, B.y, C.x, C.y);
-			if (cross2(C - A, B - A) < 0.0f)
+			if (y < min(A.y, min(B.y, C.y)) || y > max(A.y, max(B.y, C.y)))
 			{
-				vec2 t = A;
-				A = C;
-				C = t;
+				return;
 			}
-			vec2 a = B - A;
-			vec2 b = A - 2.0f * B + C;
-			vec2 c = a * 2.0f;
-			vec2 d = A - pos;
-
-			float kk = 1.0f / dot(b, b);
-			float kx = kk * dot(a, b);
-			float ky = kk * (2.0f * dot(a, a) + dot(d, b)) / 3.0f;
-			float kz = kk * dot(d, a);
-
-			float res = 0.0f;
-			float sgn = 1.0f;
-
-			float p = ky - kx * kx;
-			float p3 = p * p * p;
-			float q = kx * (2.0f * kx * kx - 3.0f * ky) + kz;
-			float h = q * q + 4.0f * p3;
-			float sa = cross2(A - 0.f, pos - 0.f);
-			float sc = cross2(C - A, pos - A);
-			float s0 = cross2(0.f - C, pos - C);
-
-			if (h >= 0.0)
-			{   // 1 root
-				h = std::sqrt(h);
-				vec2 x = (vec2(h, -h) - q) / 2.0f;
-				vec2 uv = sign(x) * pow(abs(x), vec2(1.0f / 3.0f));
-				float t = clamp(uv.x + uv.y - kx, 0.0f, 1.0f);
-				vec2 q = d + (c + b * t) * t;
-				res = dot2(q);
-				sgn = cross2(c + 2.0f * b * t, q);
+			// y(t) = a t^2 + b t + c
+			float a = A.y - 2.0f * B.y + C.y;
+			float b = 2.0f * (B.y - A.y);
+			float c = A.y - y;
+			float t[2];
+			int n = 0;
+			if (std::abs(a) < 1e-6f)
+			{
+				if (b != 0.0f)
+				{
+					t[n++] = -c / b;
+				}
 			}
 			else
-			{   // 3 roots
-				float z = std::sqrt(-p);
-				float v = std::acos(q / (p * z * 2.0f)) / 3.0f;
-				float m = std::cos(v);
-				float n = std::sin(v) * 1.732050808f;
-				vec2 t = clamp(vec2(m + m, -n - m) * z - kx, 0.0f, 1.0f);
-				vec2 qx = d + (c + b * t.x) * t.x;
-				float dx = dot2(qx), sx = cross2(c + 2.0f * b * t.x, qx);
-				vec2 qy = d + (c + b * t.y) * t.y;
-				float dy = dot2(qy), sy = cross2(c + 2.0f * b * t.y, qy);
-				if (dx < dy)
+			{
+				float disc = b * b - 4.0f * a * c;
+				if (disc >= 0.0f)
+				{
+					float sq = std::sqrt(disc);
+					t[n++] = (-b - sq) / (2.0f * a);
+					t[n++] = (-b + sq) / (2.0f * a);
+				}
+			}
+			for (int i = 0; i < n; ++i)
+			{
+				float ti = t[i];
+				float dy = b + 2.0f * a * ti;
+				if (ti < 0.0f || ti >= 1.0f || dy == 0.0f)
+				{
+					continue;
+				}
+				float x = (1.0f - ti) * (1.0f - ti) * A.x + 2.0f * ti * (1.0f - ti) * B.x + ti * ti * C.x;
+				crossings.push_back({x, dy > 0.0f ? 1 : -1});
+			}
+		}
+
+		struct SDFTileGrid
+		{
+			std::vector<SDFTile> tiles;
+			std::vector<uint32_t> indices;
+			std::vector<uint8_t> nearMask;
+			std::vector<uint8_t> inside;
+		};
+
+		// Non-zero winding rule, evaluated with one scanline pass per row over the whole outline, so that overlapping
+		// and self-intersecting contours get the right sign. The mask has one byte per output pixel, 1 inside. Called
+		// after BuildTileGrid, the tiles without near segments take their fill value from the mask.
+		inline void BuildInsideMask(SDFTileGrid& grid, std::vector<Crossing>& crossings, const vec2* points, const Command* commands, SDFJob& job)
+		{
+			std::vector<uint8_t>& inside = grid.inside;
+			inside.assign(job.width * job.height, 0);
+
+			for (int j = 0; j < job.height; ++j)
+			{
+				float y = job.originY + float(job.height - 1 - j);
+				crossings.clear();
+
+				const vec2* p = points;
+				--p;
+				for (const Command* cmd = commands; *cmd != End; ++cmd)
+				{
+					switch (*cmd)
+					{
+						case MoveTo:
+							++p;
+							break;
+						case LineTo:
+							LineCrossings(p[0], p[1], y, crossings);
+							++p;
+							break;
+						case ConicTo:
+							ConicCrossings(p[0], p[1], p[2], y, crossings);
+							p += 2;
+							break;
+						case End:
+							break;
+					}
+				}
+				if (crossings.empty())
+				{
+					continue;
+				}
+				std::sort(crossings.begin(), crossings.end());
+
+				uint8_t* row = &inside[j * job.width];
+				int winding = 0;
+				size_t c = 0;
+				for (int i = 0; i < job.width; ++i)
 				{
-					res = dx;
-					sgn = sx;
+					float x = job.originX + float(i);
+					for (; c < crossings.size() && crossings[c].x < x; ++c)
+					{
+						winding += crossings[c].dir;
+					}
+					row[i] = winding != 0;
 				}
-				else
+			}
+			job.inside = inside.data();
+
+			for (SDFTile& tile : grid.tiles)
+			{
+				tile.fill = inside[tile.y * job.width + tile.x] ? 255 : 0;
+			}
+		}
+
+		// Splits the output of the job into tiles and bins the segments into them. A segment is near a tile if its
+		// control points bounding box, grown by the distance at which the output saturates, overlaps the tile.
+		// The job's segments must be in the same order as the commands. The fill of the tiles is set by BuildInsideMask.
+		inline void BuildTileGrid(SDFTileGrid& grid, const vec2* points, const Command* commands, SDFJob& job)
+		{
+			float reach = max(job.bias, 255.0f - job.bias) / job.scale + 1.0f;
+
+			int tilesX = (job.width + k_sdfTileSize - 1) / k_sdfTileSize;
+			int tilesY = (job.height + k_sdfTileSize - 1) / k_sdfTileSize;
+			int tileCount = tilesX * tilesY;
+			int segmentCount = job.segmentCount;
+
+			grid.nearMask.assign(tileCount * segmentCount, 0);
+
+			const vec2* p = points;
+			--p;
+			int segment = 0;
+			for (const Command* cmd = commands; *cmd != End; ++cmd)
+			{
+				vec2 bmin, bmax;
+				switch (*cmd)
+				{
+					case MoveTo:
+						++p;
+						continue;
+					case LineTo:
+						bmin = vec2(min(p[0].x, p[1].x), min(p[0].y, p[1].y));
+						bmax = vec2(max(p[0].x, p[1].x), max(p[0].y, p[1].y));
+						++p;
+						break;
+					case ConicTo:
+						bmin = vec2(min(p[0].x, min(p[1].x, p[2].x)), min(p[0].y, min(p[1].y, p[2].y)));
+						bmax = vec2(max(p[0].x, max(p[1].x, p[2].x)), max(p[0].y, max(p[1].y, p[2].y)));
+						p += 2;
+						break;
+					case End:
+						continue;
+				}
+				// to pixel indices, row 0 is at the top
+				int i0 = (int)std::floor(bmin.x - job.originX - reach);
+				int i1 = (int)std::ceil(bmax.x - job.originX + reach);
+				int j0 = (int)std::floor(job.height - 1 - (bmax.y - job.originY) - reach);
+				int j1 = (int)std::ceil(job.height - 1 - (bmin.y - job.originY) + reach);
+				int tx0 = max(i0, 0) / k_sdfTileSize;
+				int tx1 = min(i1 / k_sdfTileSize, tilesX - 1);
+				int ty0 = max(j0, 0) / k_sdfTileSize;
+				int ty1 = min(j1 / k_sdfTileSize, tilesY - 1);
+				for (int ty = ty0; ty <= ty1; ++ty)
 				{
-					res = dy;
-					sgn = sy;
+					for (int tx = tx0; tx <= tx1; ++tx)
+					{
+						grid.nearMask[(ty * tilesX + tx) * segmentCount + segment] = 1;
+					}
 				}
+				++segment;
 			}
-			bool has_neg = (sa < 0.f) || (sc < 0.f) || (s0 < 0.f);
-			bool has_pos = (sa > 0.f) || (sc > 0.f) || (s0 > 0.f);
 
-			float ts = 1.0f - float(!(has_neg && has_pos)) * 2.0f;
+			grid.tiles.resize(tileCount);
+			grid.indices.resize(tileCount * segmentCount);
+			uint32_t* indices = grid.indices.data();
+			for (int ty = 0; ty < tilesY; ++ty)
+			{
+				for (int tx = 0; tx < tilesX; ++tx)
+				{
+					int t = ty * tilesX + tx;
+					SDFTile& tile = grid.tiles[t];
+					tile.x = tx * k_sdfTileSize;
+					tile.y = ty * k_sdfTileSize;
+					tile.width = min(int(k_sdfTileSize), job.width - tile.x);
+					tile.height = min(int(k_sdfTileSize), job.height - tile.y);
+
+					const uint8_t* isNear = &grid.nearMask[t * segmentCount];
+					tile.nearSegments = indices;
+					for (int s = 0; s < segmentCount; ++s)
+					{
+						if (isNear[s])
+						{
+							*indices++ = s;
+						}
+					}
+					tile.nearCount = int(indices - tile.nearSegments);
+				}
+			}
+			job.tiles = grid.tiles.data();
+			job.tileCount = tileCount;
+		}
+
+		// Points the bitmap to a zeroed area of the buffer, that covers the control box of the outline and margin pixels
+		// around it, with `channels` bytes per pixel. The buffer is only grown, the bitmap does not own it and must not be
+		// released with FT_Done_Glyph.
+		inline void SetupBitmap(FT_BitmapGlyphRec_& bitmap, const FT_Outline& outline, int margin, int channels, std::vector<uint8_t>& buffer)
+		{
+			FT_BBox acbox;
+			FT_Outline_Get_CBox(&outline, &acbox);
+
+			int bbox_xmin = acbox.xMin / 64 - margin;
+			int bbox_ymin = acbox.yMin / 64 - margin;
+			int bbox_xmax = (acbox.xMax + 63) / 64 + margin;
+			int bbox_ymax = (acbox.yMax + 63) / 64 + margin;
 
-			return std::sqrt(res) * sign(sc <= 0.f ? 1.0f : -sgn) * ts;
+			bitmap.left = bbox_xmin;
+			bitmap.top = bbox_ymax;
+			unsigned int glyph_width = bbox_xmax - bbox_xmin;
+			unsigned int glyph_height = bbox_ymax - bbox_ymin;
+			unsigned int bitmap_size = glyph_width * glyph_height * channels;
+
+			if (buffer.size() < bitmap_size)
+			{
+				buffer.resize(bitmap_size);
+			}
+			memset(buffer.data(), 0, bitmap_size);
+			bitmap.bitmap.buffer = buffer.data();
+			bitmap.bitmap.width = glyph_width;
+			bitmap.bitmap.rows = glyph_height;
+			bitmap.bitmap.pitch = glyph_width * channels;
+		}
+
+		enum
+		{
+			// Depth limit of the cubic subdivision, up to 2^k_sdfCubicMaxDepth conics per cubic
+			k_sdfCubicMaxDepth = 5
+		};
+
+		// Largest distance in pixels between a cubic and the conics that approximate it
+		const float k_sdfCubicTolerance = 1.0f / 32.0f;
+
+		inline void PushLine(std::vector<vec2>& points, std::vector<Command>& commands, vec2 b)
+		{
+			if (points.back() != b)
+			{
+				points.push_back(b);
+				commands.push_back(LineTo);
+			}
 		}
 
-		inline float intersection(float d1, float d2)
+		inline void PushConic(std::vector<vec2>& points, std::vector<Command>& commands, vec2 b, vec2 c)
 		{
-			float dmin = min(abs(d1), abs(d2));
-			return dmin * sign(d1) * sign(d2);
+			// a control point half way along the chord is a line too, and would make the segment constants infinite
+			vec2 a = points.back();
+			vec2 curvature = a - 2.0f * b + c;
+			if (a == b || b == c || dot(curvature, curvature) < 1e-12f)
+			{
+				PushLine(points, commands, c);
+			}
+			else
+			{
+				points.push_back(b);
+				points.push_back(c);
+				commands.push_back(ConicTo);
+			}
+		}
+
+		// Approximates the cubic a, b, c, d with conics. The conic that shares the end tangents of the cubic is off by
+		// at most sqrt(3) / 36 * |d - 3c + 3b - a|, the cubic is halved until that is below the tolerance.
+		inline void PushCubic(std::vector<vec2>& points, std::vector<Command>& commands, vec2 a, vec2 b, vec2 c, vec2 d, int depth = 0)
+		{
+			vec2 delta = d - 3.0f * c + 3.0f * b - a;
+			float error = 0.0481125224f * length(delta);
+			if (error <= k_sdfCubicTolerance || depth == k_sdfCubicMaxDepth)
+			{
+				PushConic(points, commands, (3.0f * (b + c) - a - d) / 4.0f, d);
+				return;
+			}
+			vec2 ab = (a + b) / 2.0f;
+			vec2 bc = (b + c) / 2.0f;
+			vec2 cd = (c + d) / 2.0f;
+			vec2 abc = (ab + bc) / 2.0f;
+			vec2 bcd = (bc + cd) / 2.0f;
+			vec2 middle = (abc + bcd) / 2.0f;
+			PushCubic(points, commands, a, ab, abc, middle, depth + 1);
+			PushCubic(points, commands, middle, bcd, cd, d, depth + 1);
 		}
 
-		inline void intersection(float* d0, simd::f4 d2)
+		// Converts the outline to a MoveTo/LineTo/ConicTo command stream in pixels, terminated with End. Cubic segments,
+		// as in CFF fonts, are approximated with conics. Returns the number of commands, or -1 if the outline is malformed.
+		inline int DecomposeOutline(const FT_Outline& outline, std::vector<vec2>& points, std::vector<Command>& commands)
 		{
-			float d4[4];
-			VSTORE(d4, d2);
-			d0[0] = intersection(d0[0], d4[0]);
-			d0[1] = intersection(d0[1], d4[1]);
-			d0[2] = intersection(d0[2], d4[2]);
-			d0[3] = intersection(d0[3], d4[3]);
+			points.clear();
+			commands.clear();
+
+			int first = 0;
+			for (int n = 0; n < outline.n_contours; ++n)
+			{
+				int last = outline.contours[n];
+				FT_Vector* limit = outline.points + last;
+				vec2 v_start = vec2(outline.points[first].x, outline.points[first].y) / 64.0f;
+				vec2 v_last = vec2(outline.points[last].x, outline.points[last].y) / 64.0f;
+				vec2 v_control;
+				FT_Vector* point = outline.points + first;
+				char* tags = outline.tags + first;
+				char tag = FT_CURVE_TAG(tags[0]);
+				if (tag == FT_CURVE_TAG_CUBIC)
+				{
+					return -1;
+				}
+				if (tag == FT_CURVE_TAG_CONIC)
+				{
+					// start at the last point if it is on the curve, otherwise half way between the two control points
+					if (FT_CURVE_TAG(outline.tags[last]) == FT_CURVE_TAG_ON)
+					{
+						v_start = v_last;
+						limit--;
+					}
+					else
+					{
+						v_start = (v_start + v_last) / 2.0f;
+					}
+				}
+				--point;
+				--tags;
+
+				points.push_back(v_start);
+				commands.push_back(MoveTo);
+
+				while (point < limit)
+				{
+					++point;
+					++tags;
+					tag = FT_CURVE_TAG(tags[0]);
+					vec2 p = vec2(point->x, point->y) / 64.0f;
+					switch (tag)
+					{
+						case FT_CURVE_TAG_ON:
+							PushLine(points, commands, p);
+							continue;
+						case FT_CURVE_TAG_CONIC:
+							v_control = p;
+						Do_Conic:
+							if (point < limit)
+							{
+								++point;
+								++tags;
+								tag = FT_CURVE_TAG(tags[0]);
+								vec2 p = vec2(point->x, point->y) / 64.0f;
+								if (tag == FT_CURVE_TAG_ON)
+								{
+									PushConic(points, commands, v_control, p);
+									continue;
+								}
+								if (tag != FT_CURVE_TAG_CONIC)
+								{
+									return -1;
+								}
+								vec2 v_middle = (v_control + p) / 2.0f;
+								PushConic(points, commands, v_control, v_middle);
+								v_control = p;
+								goto Do_Conic;
+							}
+							PushConic(points, commands, v_control, v_start);
+							goto Close;
+						default:
+						{
+							if (point + 1 > limit || FT_CURVE_TAG(tags[1]) != FT_CURVE_TAG_CUBIC)
+							{
+								return -1;
+							}
+							vec2 a = points.back();
+							vec2 c = vec2(point[1].x, point[1].y) / 64.0f;
+							point += 2;
+							tags += 2;
+							if (point <= limit)
+							{
+								PushCubic(points, commands, a, p, c, vec2(point->x, point->y) / 64.0f);
+								continue;
+							}
+							PushCubic(points, commands, a, p, c, v_start);
+							goto Close;
+						}
+					}
+				}
+				if (points.back() != v_start)
+				{
+					PushLine(points, commands, v_start);
+				}
+				Close:
+				first = last + 1;
+			}
+			int cmd_count = (int)commands.size();
+			commands.push_back(End);
+			return cmd_count;
 		}
 
-		inline void intersection(float* d0, float d1, float d2, float d3, float d4)
+		inline void BuildSegments(std::vector<SDFSegment>& segments, const vec2* points, const Command* commands)
 		{
-			d0[0] = intersection(d0[0], d1);
-			d0[1] = intersection(d0[1], d2);
-			d0[2] = intersection(d0[2], d3);
-			d0[3] = intersection(d0[3], d4);
+			const vec2* p = points;
+			--p;
+			for (const Command* cmd = commands; *cmd != End; ++cmd)
+			{
+				switch (*cmd)
+				{
+					case MoveTo:
+						++p;
+						break;
+					case LineTo:
+						segments.push_back(MakeLineSegment(p[0], p[1]));
+						++p;
+						break;
+					case ConicTo:
+						segments.push_back(MakeConicSegment(p[0], p[1], p[2]));
+						p += 2;
+						break;
+					case End:
+						break;
+				}
+			}
 		}
 
-		struct FT_Glyph_Class_
+		// Scratch memory of the rasterizers. There is one per thread, reused for every glyph, so that once it has grown to
+		// fit the largest glyph rasterizing does not allocate.
+		struct OutlineArena
 		{
-			FT_Long glyph_size;
-			FT_Glyph_Format glyph_format;
-			FT_Error (*glyph_init)(FT_Glyph glyph, FT_GlyphSlot slot);
-			void (*glyph_done)(FT_Glyph glyph);
-			FT_Error (*glyph_copy)(FT_Glyph source, FT_Glyph target);
-			void (*glyph_transform)(FT_Glyph glyph, const FT_Matrix*  matrix, const FT_Vector*  delta);
-			void (*glyph_bbox)(FT_Glyph glyph, FT_BBox* abbox);
-			FT_Error (*glyph_prepare)(FT_Glyph glyph, FT_GlyphSlot slot);
+			std::vector<vec2> points;
+			std::vector<Command> commands;
+			std::vector<SDFSegment> segments;
+			std::vector<Crossing> crossings;
+			SDFTileGrid grid;
+
+			// EDT generator
+			std::vector<FT_Vector> scaledPoints;
+			std::vector<uint8_t> coverage;
+			std::vector<float> toInside;
+			std::vector<float> toOutside;
+			std::vector<float> envelope;
+			std::vector<int> indices;
+
+			// the raster of a library must not be used by two threads at once, so each arena has its own
+			FT_Library library = nullptr;
+
+			FT_Library GetLibrary()
+			{
+				if (library == nullptr)
+				{
+					FT_Init_FreeType(&library);
+				}
+				return library;
+			}
+
+			~OutlineArena()
+			{
+				if (library != nullptr)
+				{
+					FT_Done_FreeType(library);
+				}
+			}
 		};
 
-		enum Command: uint8_t
+		inline OutlineArena& GetOutlineArena()
 		{
-			MoveTo,
-			LineTo,
-			ConicTo,
-			End
+			static thread_local OutlineArena arena;
+			return arena;
+		}
+
+		enum
+		{
+			// Supersampling of the coverage bitmap used by the EDT generator
+			k_sdfEDTSupersample = 4,
+			// SDFGenerator::Auto uses the EDT generator when the exact kernel would compute more pixel and segment pairs
+			// per output pixel than this, per SIMD lane. Both cost about the same at 5 on every SIMD width, EDT is only
+			// taken where it is twice as fast, as it is less exact.
+			k_sdfEDTWorkPerPixel = 10
 		};
+
+		// Pixel and segment pairs the exact kernel evaluates for the tile grid, per SIMD lane
+		inline int64_t GetExactSDFWork(const SDFTileGrid& grid)
+		{
+			int64_t work = 0;
+			for (const SDFTile& tile : grid.tiles)
+			{
+				work += int64_t(tile.width) * tile.height * tile.nearCount;
+			}
+			int lanes = 4 << (GetSDFSIMDLevel() - SIMDLevel::Baseline);
+			return work / lanes;
+		}
+
+		// Squared distance transform of the sampled function f, Felzenszwalb & Huttenlocher. v and z are scratch of n and
+		// n + 1 elements.
+		inline void DistanceTransform1D(const float* f, float* d, int n, int* v, float* z)
+		{
+			const float inf = 1e20f;
+			int k = 0;
+			v[0] = 0;
+			z[0] = -inf;
+			z[1] = inf;
+			for (int q = 1; q < n; ++q)
+			{
+				float s = ((f[q] + float(q * q)) - (f[v[k]] + float(v[k] * v[k]))) / float(2 * q - 2 * v[k]);
+				while (s <= z[k])
+				{
+					--k;
+					s = ((f[q] + float(q * q)) - (f[v[k]] + float(v[k] * v[k]))) / float(2 * q - 2 * v[k]);
+				}
+				++k;
+				v[k] = q;
+				z[k] = s;
+				z[k + 1] = inf;
+			}
+			k = 0;
+			for (int q = 0; q < n; ++q)
+			{
+				while (z[k + 1] < float(q))
+				{
+					++k;
+				}
+				d[q] = float((q - v[k]) * (q - v[k])) + f[v[k]];
+			}
+		}
+
+		// Squared distances along the columns of a binary image to the nearest sample that is inside (coverage >= 128)
+		// and to the nearest one that is outside. That is the first pass of the separable transform, for binary input it
+		// is a forward and a backward sweep instead of the lower envelope.
+		inline void ColumnDistances(const uint8_t* coverage, int width, int height, float* toInside, float* toOutside)
+		{
+			const int inf = 1 << 20;
+			for (int i = 0; i < width; ++i)
+			{
+				int lastInside = -inf;
+				int lastOutside = -inf;
+				for (int j = 0; j < height; ++j)
+				{
+					int k = j * width + i;
+					if (coverage[k] >= 128)
+					{
+						lastInside = j;
+					}
+					else
+					{
+						lastOutside = j;
+					}
+					toInside[k] = float(j - lastInside);
+					toOutside[k] = float(j - lastOutside);
+				}
+				lastInside = inf;
+				lastOutside = inf;
+				for (int j = height - 1; j >= 0; --j)
+				{
+					int k = j * width + i;
+					if (coverage[k] >= 128)
+					{
+						lastInside = j;
+					}
+					else
+					{
+						lastOutside = j;
+					}
+					float di = min(toInside[k], float(lastInside - j));
+					float dout = min(toOutside[k], float(lastOutside - j));
+					toInside[k] = di < float(inf) ? di * di : 1e20f;
+					toOutside[k] = dout < float(inf) ? dout * dout : 1e20f;
+				}
+			}
+		}
+
+		// SDF from a coverage bitmap rendered by FreeType at k_sdfEDTSupersample times the resolution of the output. The
+		// cost only depends on the pixel count. Distances are measured between sample centers and the boundary is taken
+		// half way between an inside and an outside sample, so the error is up to about half a sample.
+		inline void RenderSDFEDT(FT_Library library, const FT_Outline& outline, const SDFJob& job, int left, int bottom, OutlineArena& arena)
+		{
+			const int ss = k_sdfEDTSupersample;
+			int width = job.width * ss;
+			int height = job.height * ss;
+
+			std::vector<FT_Vector>& points = arena.scaledPoints;
+			points.assign(outline.points, outline.points + outline.n_points);
+			for (FT_Vector& point : points)
+			{
+				point.x = (point.x - left * 64) * ss;
+				point.y = (point.y - bottom * 64) * ss;
+			}
+			FT_Outline scaled = outline;
+			scaled.points = points.data();
+
+			std::vector<uint8_t>& coverage = arena.coverage;
+			coverage.assign(width * height, 0);
+			FT_Bitmap target;
+			memset(&target, 0, sizeof(target));
+			target.width = width;
+			target.rows = height;
+			target.pitch = width;
+			target.buffer = coverage.data();
+			target.pixel_mode = FT_PIXEL_MODE_GRAY;
+			target.num_grays = 256;
+			FT_Outline_Get_Bitmap(library, &scaled, &target);
+
+			// squared distances to the nearest inside and outside sample
+			std::vector<float>& toInside = arena.toInside;
+			std::vector<float>& toOutside = arena.toOutside;
+			toInside.resize(width * height);
+			toOutside.resize(width * height);
+			ColumnDistances(coverage.data(), width, height, toInside.data(), toOutside.data());
+
+			arena.envelope.resize(width * 2 + 1);
+			arena.indices.resize(width);
+			float* f = arena.envelope.data();
+			float* z = f + width;
+			for (int j = 0; j < height; ++j)
+			{
+				float* rows[2] = {&toInside[j * width], &toOutside[j * width]};
+				for (float* row : rows)
+				{
+					memcpy(f, row, width * sizeof(float));
+					DistanceTransform1D(f, row, width, arena.indices.data(), z);
+				}
+			}
+
+			// each output pixel is the average of its block of samples, rows of both are top to bottom
+			const float norm = 1.0f / float(ss * ss * ss);
+			for (int j = 0; j < job.height; ++j)
+			{
+				for (int i = 0; i < job.width; ++i)
+				{
+					float sum = 0.0f;
+					for (int y = j * ss; y < (j + 1) * ss; ++y)
+					{
+						for (int x = i * ss; x < (i + 1) * ss; ++x)
+						{
+							int k = y * width + x;
+							sum += toInside[k] != 0.0f ? std::sqrt(toInside[k]) - 0.5f : 0.5f - std::sqrt(toOutside[k]);
+						}
+					}
+					float x = clamp(sum * norm * job.scale + job.bias, 0.0f, 255.0f);
+					job.output[j * job.width + i] = uint8_t(255 - int(x));
+				}
+			}
+		}
 	}
 
-    inline FT_BitmapGlyph RenderSDF(int margin, float cutoff, FT_Face ft_face)
-    {
-		FT_BitmapGlyphRec_* bitmap = (FT_BitmapGlyphRec_*)malloc(sizeof(FT_BitmapGlyphRec_));
-		memset(bitmap, 0, sizeof(FT_BitmapGlyphRec_));
-    	bitmap->root.format = FT_Glyph_Format::FT_GLYPH_FORMAT_BITMAP;
-    	bitmap->root.library = ft_face->glyph->library;
-    	static detail::FT_Glyph_Class_ custom_class = {sizeof(FT_BitmapGlyphRec_), FT_Glyph_Format::FT_GLYPH_FORMAT_BITMAP,
-	                                                   nullptr,
-	                                                   +[](FT_Glyph glyph){ free(((FT_BitmapGlyphRec_*)(glyph))->bitmap.buffer); },
-	                                                   nullptr,nullptr,nullptr,nullptr};
-    	bitmap->root.clazz = (FT_Glyph_Class_*)&custom_class;
-
-        if (ft_face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
-        {
-            return bitmap;
-        }
-
-        FT_Outline outline = ft_face->glyph->outline;
-
-        FT_BBox acbox;
-        FT_Outline_Get_CBox(&outline, &acbox);
-
-        int bbox_xmin = acbox.xMin / 64 - margin;
-        int bbox_ymin = acbox.yMin / 64 - margin;
-        int bbox_xmax = (acbox.xMax + 63) / 64 + margin;
-        int bbox_ymax = (acbox.yMax + 63) / 64 + margin;
-
-        bitmap->left = bbox_xmin;
-        bitmap->top = bbox_ymax;
-        int glyph_width = bbox_xmax - bbox_xmin;
-        int glyph_height = bbox_ymax - bbox_ymin;
-
-        unsigned int buffered_width = glyph_width;
-        unsigned int buffered_height = glyph_height;
-        unsigned int bitmap_size = buffered_width * buffered_height;
-
-        bitmap->bitmap.buffer = (unsigned char*)malloc(bitmap_size);
-        memset(bitmap->bitmap.buffer, 0, bitmap_size);
-        bitmap->bitmap.width = buffered_width;
-        bitmap->bitmap.rows = buffered_height;
-
-        vec2 points[4096 * 4];
-        assert(outline.n_points < 4096 * 4);
-        detail::Command commands[4096 * 4];
-        int point_it = 0;
-        int cmd_it = 0;
-        auto push_line = [&points, &point_it, &commands, &cmd_it](vec2 b)
-        {
-        	if (points[point_it - 1] != b)
-	        {
-		        points[point_it++] = b;
-		        commands[cmd_it++] = detail::LineTo;
-	        }
-        };
-        auto push_conic = [&points, &point_it, &commands, &cmd_it, &push_line](vec2 b, vec2 c)
-        {
-        	if (points[point_it - 1] == b || b == c)
-	        {
-        		push_line(c);
-	        }
-        	else
-	        {
-	            points[point_it++] = b;
-		        points[point_it++] = c;
-		        commands[cmd_it++] = detail::ConicTo;
-	        }
-        };
-
-	    int first = 0;
-	    for (int n = 0; n < outline.n_contours; ++n)
-	    {
-		    using namespace detail;
-
-		    int last = outline.contours[n];
-		    FT_Vector* limit = outline.points + last;
-		    vec2 v_start = vec2(outline.points[first].x, outline.points[first].y) / 64.0f;
-		    vec2 v_last = vec2(outline.points[last].x, outline.points[last].y) / 64.0f;
-		    vec2 v_control;
-		    FT_Vector* point = outline.points + first;
-		    char* tags = outline.tags + first;
-		    char tag = FT_CURVE_TAG(tags[0]);
-		    if (tag == FT_CURVE_TAG_CUBIC)
-		    {
-			    return bitmap;
-		    }
-		    if (tag == FT_CURVE_TAG_CONIC)
-		    {
-			    v_start = v_last;
-			    limit--;
-		    }
-		    else
-		    {
-			    v_start = (v_start + v_last) / 2.0f;
-		    }
-		    --point;
-		    --tags;
-
-		    points[point_it++] = v_start;
-		    commands[cmd_it++] = detail::MoveTo;
-
-		    while (point < limit)
-		    {
-			    ++point;
-			    ++tags;
-			    tag = FT_CURVE_TAG(tags[0]);
-			    vec2 p = vec2(point->x, point->y) / 64.0f;
-			    switch (tag)
-			    {
-				    case FT_CURVE_TAG_ON:
-				    	push_line(p);
-					    continue;
-				    case FT_CURVE_TAG_CONIC:
-					    v_control = p;
-				    Do_Conic:
-					    if (point < limit)
-					    {
-						    ++point;
-						    ++tags;
-						    tag = FT_CURVE_TAG(tags[0]);
-						    vec2 p = vec2(point->x, point->y) / 64.0f;
-						    if (tag == FT_CURVE_TAG_ON)
-						    {
-								push_conic(v_control, p);
-							    continue;
-						    }
-						    if (tag != FT_CURVE_TAG_CONIC)
-						    {
-							    return bitmap;
-						    }
-						    vec2 v_middle = (v_control + p) / 2.0f;
-							push_conic(v_control, v_middle);
-						    v_control = p;
-						    goto Do_Conic;
-					    }
-						push_conic(v_control, v_start);
-					    goto Close;
-				    default:
-					    return bitmap;
-
-			    }
-		    }
-		    if (points[point_it] != v_start)
-		    {
-				push_line(v_start);
-		    }
-		    Close:
-		    first = last + 1;
-	    }
-		commands[cmd_it] = detail::End;
-        assert(cmd_it < 4096 * 4);
-        assert(point_it < 4096 * 4);
-
-	    int radius = 8;
-	    float radius_by_256 = (256.0f / radius);
-
-	    unsigned char* __restrict bmp = bitmap->bitmap.buffer;
-	    parallel_for(unsigned int i = 0; i < buffered_height * buffered_width; i += 4)
-	    {
-		    vec2 pt[4] =
-				    {
-		    		    vec2((i + 0) % buffered_width, buffered_height - 1 - ((i + 0) / buffered_width)) + vec2(bbox_xmin, bbox_ymin) + vec2(0.513f, 0.507f),
-		    		    vec2((i + 1) % buffered_width, buffered_height - 1 - ((i + 1) / buffered_width)) + vec2(bbox_xmin, bbox_ymin) + vec2(0.513f, 0.507f),
-		    		    vec2((i + 2) % buffered_width, buffered_height - 1 - ((i + 2) / buffered_width)) + vec2(bbox_xmin, bbox_ymin) + vec2(0.513f, 0.507f),
-		    		    vec2((i + 3) % buffered_width, buffered_height - 1 - ((i + 3) / buffered_width)) + vec2(bbox_xmin, bbox_ymin) + vec2(0.513f, 0.507f),
-				    };
-		    float pos_simd[8] = {pt[0].x,pt[1].x,pt[2].x,pt[3].x,pt[0].y,pt[1].y,pt[2].y,pt[3].y};
-
-		    float d[4] = {1e6f, 1e6f, 1e6f, 1e6f};
-
-		    const vec2* __restrict p = points;
-		    --p;
-
-		    for (auto* __restrict cmd = commands; *cmd != detail::End; ++cmd)
-		    {
-			    switch (*cmd)
-			    {
-				    case detail::MoveTo:
-					    ++p;
-					    break;
-				    case detail::LineTo:
-					    // detail::intersection(d, detail::sdLine(pt[0], p[0], p[1]), detail::sdLine(pt[1], p[0], p[1]), detail::sdLine(pt[2], p[0], p[1]), detail::sdLine(pt[3], p[0], p[1]));
-					    detail::intersection(d, detail::sdLineSIMD(pos_simd, p[0], p[1]));
-					    ++p;
-					    break;
-				    case detail::ConicTo:
-					    detail::intersection(d, detail::sdBezier(pt[0], p[0], p[1], p[2]), detail::sdBezier(pt[1], p[0], p[1], p[2]), detail::sdBezier(pt[2], p[0], p[1], p[2]), detail::sdBezier(pt[3], p[0], p[1], p[2]));
-					    p += 2;
-					    break;
-				    case detail::End:
-					    break;
-			    }
-		    }
-
-		    d[0] = d[0] * radius_by_256 + cutoff * 256.0f;
-		    d[1] = d[1] * radius_by_256 + cutoff * 256.0f;
-		    d[2] = d[2] * radius_by_256 + cutoff * 256.0f;
-		    d[3] = d[3] * radius_by_256 + cutoff * 256.0f;
-		    bmp[i + 0] = 255 - clamp((int) d[0], 0, 255);
-		    bmp[i + 1] = 255 - clamp((int) d[1], 0, 255);
-		    bmp[i + 2] = 255 - clamp((int) d[2], 0, 255);
-		    bmp[i + 3] = 255 - clamp((int) d[3], 0, 255);
-	    }
-        return bitmap;
-    }
+	// Rasterizes the outline into `bitmap`. The pixels are stored in `buffer`, see detail::SetupBitmap. It only uses
+	// the scratch memory of the calling thread, so different glyphs can be rasterized concurrently.
+	inline FT_BitmapGlyph RenderSDF(int margin, float cutoff, const FT_Outline& outline, SDFGenerator::Enum generator, std::vector<uint8_t>& buffer, FT_BitmapGlyphRec_& bitmap)
+	{
+		memset(&bitmap, 0, sizeof(FT_BitmapGlyphRec_));
+		bitmap.root.format = FT_GLYPH_FORMAT_BITMAP;
+
+		detail::SetupBitmap(bitmap, outline, margin, 1, buffer);
+		detail::OutlineArena& arena = detail::GetOutlineArena();
+
+		int radius = 8;
+		float radius_by_256 = (256.0f / radius);
+
+		detail::SDFJob job;
+		job.segments = nullptr;
+		job.segmentCount = 0;
+		job.width = bitmap.bitmap.width;
+		job.height = bitmap.bitmap.rows;
+		job.originX = bitmap.left + 0.513f;
+		job.originY = bitmap.top - (int)bitmap.bitmap.rows + 0.507f;
+		job.scale = radius_by_256;
+		job.bias = cutoff * 256.0f;
+		job.output = bitmap.bitmap.buffer;
+		job.skipSaturated = detail::GetSDFSkipSaturated();
+
+		int cmd_count = -1;
+		if (generator != SDFGenerator::EDT)
+		{
+			cmd_count = detail::DecomposeOutline(outline, arena.points, arena.commands);
+		}
+
+		// malformed outlines are left to the FreeType raster of the EDT generator
+		if (cmd_count < 0)
+		{
+			detail::RenderSDFEDT(arena.GetLibrary(), outline, job, bitmap.left, bitmap.top - (int)bitmap.bitmap.rows, arena);
+			return &bitmap;
+		}
+
+		const vec2* points = arena.points.data();
+		const detail::Command* commands = arena.commands.data();
+
+		arena.segments.clear();
+		detail::BuildSegments(arena.segments, points, commands);
+		job.segments = arena.segments.data();
+		job.segmentCount = (int)arena.segments.size();
+
+		detail::BuildTileGrid(arena.grid, points, commands, job);
+
+		// the grid tells how much work the exact kernel has, a glyph only goes to EDT if that costs less
+		if (generator == SDFGenerator::Auto && detail::GetExactSDFWork(arena.grid) > int64_t(job.width) * job.height * detail::k_sdfEDTWorkPerPixel)
+		{
+			detail::RenderSDFEDT(arena.GetLibrary(), outline, job, bitmap.left, bitmap.top - (int)bitmap.bitmap.rows, arena);
+			return &bitmap;
+		}
+
+		detail::BuildInsideMask(arena.grid, arena.crossings, points, commands, job);
+
+		int skipped = detail::GetSDFKernel()(job);
+		detail::AddSDFStats(job.width * job.height, skipped);
+
+		return &bitmap;
+	}
 }
@@ -1,6 +1,11 @@
 #pragma once
 #include "Utils.h"
 
+// Vector vocabulary used by the SDF kernels. A translation unit picks the vector width by defining
+// SCRIBER_SIMD_AVX512 or SCRIBER_SIMD_AVX2 before including this header (and being compiled with the
+// matching instruction set), otherwise the 128 bit SSE/NEON version is used.
+// SIMD_WIDTH is the number of float lanes in simd::vfloat.
+
 #if (defined(_M_X64) || defined(_M_ARM64) || defined(__x86_64__) || defined(__aarch64__))
 #define SCRIBER_SIMD
 #endif
@@ -13,6 +18,12 @@
 #define HAVE_SSE 1
 #include <immintrin.h>
 
+#if defined(SCRIBER_SIMD_AVX512) && defined(__AVX512F__)
+#define HAVE_AVX512 1
+#elif defined(SCRIBER_SIMD_AVX2) && defined(__AVX2__)
+#define HAVE_AVX2 1
+#endif
+
 #elif defined(__ARM_NEON) || defined(__aarch64__)
 #define SCRIBER_SIMD
 #include <arm_neon.h>
@@ -23,8 +34,84 @@
 
 namespace simd
 {
-#if defined(HAVE_SSE)
-	typedef __m128 f4;
+#if defined(HAVE_AVX512)
+	typedef __m512 vfloat;
+	typedef __mmask16 vmask;
+	typedef __m512i vint;
+#define SIMD_WIDTH 16
+#define VSTORE _mm512_storeu_ps
+#define VLD _mm512_loadu_ps
+#define VSET _mm512_set1_ps
+#define VADD _mm512_add_ps
+#define VSUB _mm512_sub_ps
+#define VMUL _mm512_mul_ps
+#define VDIV _mm512_div_ps
+#define VMIN _mm512_min_ps
+#define VMAX _mm512_max_ps
+#define RSQRT _mm512_rsqrt14_ps
+#define SQRT _mm512_sqrt_ps
+#define VMAC(a, x, y) _mm512_fmadd_ps(x, y, a)
+#define VMSB(a, x, y) _mm512_fnmadd_ps(x, y, a)
+#define VMUL_S(x, s)  _mm512_mul_ps(x, _mm512_set1_ps(s))
+#define VABS _mm512_abs_ps
+#define VNEG(x) _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(x), _mm512_set1_epi32(int(0x80000000))))
+#define VCMPLT(a, b) _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ)
+#define VCMPLE(a, b) _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ)
+#define VCMPGT(a, b) _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ)
+#define VCMPEQ(a, b) _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ)
+#define VMAND(a, b) (simd::vmask)((a) & (b))
+#define VMOR(a, b) (simd::vmask)((a) | (b))
+#define VMNOT(m) (simd::vmask)(~(m))
+#define VSEL(m, a, b) _mm512_mask_blend_ps(m, b, a)
+#define VASINT _mm512_castps_si512
+#define VASFLOAT _mm512_castsi512_ps
+#define VTOINT _mm512_cvttps_epi32
+#define VTOFLOAT _mm512_cvtepi32_ps
+#define VLANES _mm512_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f, 9.f, 10.f, 11.f, 12.f, 13.f, 14.f, 15.f)
+#elif defined(HAVE_AVX2)
+	typedef __m256 vfloat;
+	typedef __m256 vmask;
+	typedef __m256i vint;
+#define SIMD_WIDTH 8
+#define VSTORE _mm256_storeu_ps
+#define VLD _mm256_loadu_ps
+#define VSET _mm256_set1_ps
+#define VADD _mm256_add_ps
+#define VSUB _mm256_sub_ps
+#define VMUL _mm256_mul_ps
+#define VDIV _mm256_div_ps
+#define VMIN _mm256_min_ps
+#define VMAX _mm256_max_ps
+#define RSQRT _mm256_rsqrt_ps
+#define SQRT _mm256_sqrt_ps
+#if defined(__FMA__)
+#define VMAC(a, x, y) _mm256_fmadd_ps(x, y, a)
+#define VMSB(a, x, y) _mm256_fnmadd_ps(x, y, a)
+#else
+#define VMAC(a, x, y) _mm256_add_ps(a, _mm256_mul_ps(x, y))
+#define VMSB(a, x, y) _mm256_sub_ps(a, _mm256_mul_ps(x, y))
+#endif
+#define VMUL_S(x, s)  _mm256_mul_ps(x, _mm256_set1_ps(s))
+#define VABS(x) _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x)
+#define VNEG(x) _mm256_xor_ps(x, _mm256_set1_ps(-0.0f))
+#define VCMPLT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define VCMPLE(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define VCMPGT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define VCMPEQ(a, b) _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+#define VMAND _mm256_and_ps
+#define VMOR _mm256_or_ps
+#define VMNOT(m) _mm256_xor_ps(m, _mm256_castsi256_ps(_mm256_set1_epi32(-1)))
+#define VSEL(m, a, b) _mm256_blendv_ps(b, a, m)
+#define VASINT _mm256_castps_si256
+#define VASFLOAT _mm256_castsi256_ps
+#define VTOINT _mm256_cvttps_epi32
+#define VTOFLOAT _mm256_cvtepi32_ps
+#define VLANES _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f)
+#elif defined(HAVE_SSE)
+	typedef __m128 vfloat;
+	typedef __m128 vmask;
+	typedef __m128i vint;
+#define SIMD_WIDTH 4
 #define VSTORE _mm_storeu_ps
 #define VLD _mm_loadu_ps
 #define VSET _mm_set1_ps
@@ -40,17 +127,118 @@ namespace simd
 #define VMSB(a, x, y) _mm_sub_ps(a, _mm_mul_ps(x, y))
 #define VMUL_S(x, s)  _mm_mul_ps(x, _mm_set1_ps(s))
 #define VREV(x) _mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 1, 2, 3))
-#elif defined(HAVE_SSE)
-	typedef float32x4_t f4;
+#define VABS(x) _mm_andnot_ps(_mm_set1_ps(-0.0f), x)
+#define VNEG(x) _mm_xor_ps(x, _mm_set1_ps(-0.0f))
+#define VCMPLT _mm_cmplt_ps
+#define VCMPLE _mm_cmple_ps
+#define VCMPGT _mm_cmpgt_ps
+#define VCMPEQ _mm_cmpeq_ps
+#define VMAND _mm_and_ps
+#define VMOR _mm_or_ps
+#define VMNOT(m) _mm_xor_ps(m, _mm_castsi128_ps(_mm_set1_epi32(-1)))
+#if defined(__SSE4_1__)
+#define VSEL(m, a, b) _mm_blendv_ps(b, a, m)
+#else
+#define VSEL(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#endif
+#define VASINT _mm_castps_si128
+#define VASFLOAT _mm_castsi128_ps
+#define VTOINT _mm_cvttps_epi32
+#define VTOFLOAT _mm_cvtepi32_ps
+#define VLANES _mm_setr_ps(0.f, 1.f, 2.f, 3.f)
+#elif defined(HAVE_NEON)
+	typedef float32x4_t vfloat;
+	typedef uint32x4_t vmask;
+	typedef int32x4_t vint;
+#define SIMD_WIDTH 4
 #define VSTORE vst1q_f32
 #define VLD vld1q_f32
 #define VSET vmovq_n_f32
 #define VADD vaddq_f32
 #define VSUB vsubq_f32
 #define VMUL vmulq_f32
+#define VDIV vdivq_f32
+#define VMIN vminq_f32
+#define VMAX vmaxq_f32
+#define RSQRT vrsqrteq_f32
+#define SQRT vsqrtq_f32
 #define VMAC(a, x, y) vmlaq_f32(a, x, y)
 #define VMSB(a, x, y) vmlsq_f32(a, x, y)
 #define VMUL_S(x, s)  vmulq_f32(x, vmovq_n_f32(s))
 #define VREV(x) vcombine_f32(vget_high_f32(vrev64q_f32(x)), vget_low_f32(vrev64q_f32(x)))
+#define VABS vabsq_f32
+#define VNEG vnegq_f32
+#define VCMPLT vcltq_f32
+#define VCMPLE vcleq_f32
+#define VCMPGT vcgtq_f32
+#define VCMPEQ vceqq_f32
+#define VMAND vandq_u32
+#define VMOR vorrq_u32
+#define VMNOT vmvnq_u32
+#define VSEL(m, a, b) vbslq_f32(m, a, b)
+#define VASINT vreinterpretq_s32_f32
+#define VASFLOAT vreinterpretq_f32_s32
+#define VTOINT vcvtq_s32_f32
+#define VTOFLOAT vcvtq_f32_s32
+#define VLANES (float32x4_t{0.f, 1.f, 2.f, 3.f})
+#endif
+
+#if defined(SIMD_WIDTH)
+	// -1, 0 or 1 per lane, same as Scriber::sign
+	static inline vfloat vsign(vfloat x)
+	{
+		vfloat zero = VSET(0.0f);
+		return VSEL(VCMPGT(x, zero), VSET(1.0f), VSEL(VCMPLT(x, zero), VSET(-1.0f), zero));
+	}
+
+	// Cube root. Initial guess is taken from the exponent bits, then refined with two Halley iterations.
+	static inline vfloat vcbrt(vfloat x)
+	{
+		vfloat ax = VABS(x);
+		vfloat y = VASFLOAT(VTOINT(VADD(VMUL(VTOFLOAT(VASINT(ax)), VSET(1.0f / 3.0f)), VSET(709921077.0f))));
+		for (int i = 0; i < 2; ++i)
+		{
+			vfloat y3 = VMUL(VMUL(y, y), y);
+			y = VMUL(y, VDIV(VADD(y3, VADD(ax, ax)), VADD(VADD(y3, y3), ax)));
+		}
+		y = VSEL(VCMPEQ(ax, VSET(0.0f)), VSET(0.0f), y);
+		return VMUL(y, vsign(x));
+	}
+
+	// Arc cosine, Abramowitz and Stegun 4.4.46. Absolute error is below 2e-8 on [-1, 1].
+	static inline vfloat vacos(vfloat x)
+	{
+		x = VMAX(VMIN(x, VSET(1.0f)), VSET(-1.0f));
+		vfloat ax = VABS(x);
+		vfloat p = VSET(-0.0012624911f);
+		p = VMAC(VSET(0.0066700901f), p, ax);
+		p = VMAC(VSET(-0.0170881256f), p, ax);
+		p = VMAC(VSET(0.0308918810f), p, ax);
+		p = VMAC(VSET(-0.0501743046f), p, ax);
+		p = VMAC(VSET(0.0889789874f), p, ax);
+		p = VMAC(VSET(-0.2145988016f), p, ax);
+		p = VMAC(VSET(1.5707963050f), p, ax);
+		vfloat r = VMUL(p, SQRT(VSUB(VSET(1.0f), ax)));
+		return VSEL(VCMPLT(x, VSET(0.0f)), VSUB(VSET(3.14159265f), r), r);
+	}
+
+	// Sine and cosine for arguments in [0, pi/3], Taylor series up to the 11th/10th order.
+	static inline void vsincos_pi3(vfloat x, vfloat& s, vfloat& c)
+	{
+		vfloat x2 = VMUL(x, x);
+		vfloat ps = VSET(-1.0f / 39916800.0f);
+		ps = VMAC(VSET(1.0f / 362880.0f), ps, x2);
+		ps = VMAC(VSET(-1.0f / 5040.0f), ps, x2);
+		ps = VMAC(VSET(1.0f / 120.0f), ps, x2);
+		ps = VMAC(VSET(-1.0f / 6.0f), ps, x2);
+		ps = VMAC(VSET(1.0f), ps, x2);
+		s = VMUL(ps, x);
+		vfloat pc = VSET(-1.0f / 3628800.0f);
+		pc = VMAC(VSET(1.0f / 40320.0f), pc, x2);
+		pc = VMAC(VSET(-1.0f / 720.0f), pc, x2);
+		pc = VMAC(VSET(1.0f / 24.0f), pc, x2);
+		pc = VMAC(VSET(-1.0f / 2.0f), pc, x2);
+		c = VMAC(VSET(1.0f), pc, x2);
+	}
 #endif
 }